@@ -1,5 +1,7 @@
 #include "kernel.h"
 #include <cmath>
+#include <algorithm>
+#include <vector>
 
 Cache::Cache(int l, long int size) : l_(l), size_(size) {
   head_ = (Head *)calloc(static_cast<size_t>(l_), sizeof(Head));  // initialized to 0
@@ -99,6 +101,41 @@ void Cache::SwapIndex(int i, int j) {
   }
 }
 
+void Cache::Grow(int l) {
+  if (l <= l_) {
+    return;
+  }
+
+  // the heads are moved to a larger array and linked again from the least recently used
+  std::vector<std::ptrdiff_t> lru;
+  for (Head *h = lru_head_.next; h != &lru_head_; h = h->next) {
+    lru.push_back(h - head_);
+  }
+  Head *head = (Head *)calloc(static_cast<size_t>(l), sizeof(Head));
+  for (int i = 0; i < l_; ++i) {
+    head[i].data = head_[i].data;
+    head[i].len = head_[i].len;
+  }
+  free(head_);
+  head_ = head;
+  lru_head_.next = lru_head_.prev = &lru_head_;
+  for (std::size_t k = 0; k < lru.size(); ++k) {
+    InsertLRU(&head_[lru[k]]);
+  }
+
+  size_ -= static_cast<long int>(l-l_) * static_cast<long int>(sizeof(Head)) / static_cast<long int>(sizeof(Qfloat));
+  l_ = l;
+  while (size_ < 2 * static_cast<long int>(l_) && lru_head_.next != &lru_head_) {
+    Head *old = lru_head_.next;
+    DeleteLRU(old);
+    delete[] old->data;
+    size_ += old->len;
+    old->data = 0;
+    old->len = 0;
+  }
+  size_ = std::max(size_, 2 * static_cast<long int>(l_));  // cache must be large enough for two columns
+}
+
 // Cache end
 
 static const char *kKernelTypeNameTable[] = {
@@ -115,25 +152,41 @@ Kernel::Kernel(int l, Node *const *x, const KernelParameter *param)
      degree_(param->degree),
      gamma_(param->gamma),
      coef0_(param->coef0) {
+  own_dense_ = MakeDenseRows(l, x, param);
+  own_index_ = (own_dense_ == NULL) ? MakeSparseIndex(l, x, param) : NULL;
+  Init(l, x, own_dense_, own_index_);
+}
+
+Kernel::Kernel(int l, Node *const *x, const KernelParameter *param, const DenseRows *dense, const SparseIndex *index)
+    :kernel_type_(param->kernel_type),
+     degree_(param->degree),
+     gamma_(param->gamma),
+     coef0_(param->coef0) {
+  own_dense_ = NULL;
+  own_index_ = NULL;
+  Init(l, x, dense, index);
+}
+
+void Kernel::Init(int l, Node *const *x, const DenseRows *dense, const SparseIndex *index) {
   switch (kernel_type_) {
     case LINEAR: {
-      kernel_function = &Kernel::KernelLinear;
+      column_function_ = &Kernel::FillColumn<LinearKernel>;
       break;
     }
     case POLY: {
-      kernel_function = &Kernel::KernelPoly;
+      column_function_ = &Kernel::FillColumn<PolyKernel>;
       break;
     }
     case RBF: {
-      kernel_function = &Kernel::KernelRBF;
+      column_function_ = &Kernel::FillColumn<RBFKernel>;
       break;
     }
     case SIGMOID: {
-      kernel_function = &Kernel::KernelSigmoid;
+      column_function_ = &Kernel::FillColumn<SigmoidKernel>;
       break;
     }
     case PRECOMPUTED: {
-      kernel_function = &Kernel::KernelPrecomputed;
+      column_function_ = &Kernel::FillColumnPrecomputed;
       break;
     }
     default: {
@@ -144,10 +197,36 @@ Kernel::Kernel(int l, Node *const *x, const KernelParameter *param)
 
   clone(x_, x, l);
 
+  if (dense != NULL) {
+    dense_stride_ = dense->stride;
+    dense_x_ = new const double*[l];
+    for (int i = 0; i < l; ++i) {
+      dense_x_[i] = dense->data + static_cast<std::size_t>(i) * static_cast<std::size_t>(dense_stride_);
+    }
+  } else {
+    dense_stride_ = 0;
+    dense_x_ = NULL;
+  }
+
+  index_ = index;
+  if (index != NULL) {
+    index_row_ = new int[l];
+    for (int i = 0; i < l; ++i) {
+      index_row_[i] = i;
+    }
+    dot_ = new double[l];
+  } else {
+    index_row_ = NULL;
+    dot_ = NULL;
+  }
+
+  column_dot_ = new double[l];
+  pool_ = NULL;
+
   if (kernel_type_ == RBF) {
     x_square_ = new double[l];
     for (int i = 0; i < l; ++i) {
-      x_square_[i] = Dot(x_[i], x_[i]);
+      x_square_[i] = Dot(i, i);
     }
   } else {
     x_square_ = NULL;
@@ -156,9 +235,111 @@ Kernel::Kernel(int l, Node *const *x, const KernelParameter *param)
   KernelText();
 }
 
+// appends the rows x[l,new_l) to a kernel of l rows, which has neither dense rows nor an inverted index
+void Kernel::AppendRows(int l, int new_l, Node *const *x) {
+  const Node **rows = new const Node*[new_l];
+  std::copy(x_, x_+l, rows);
+  std::copy(x+l, x+new_l, rows+l);
+  delete[] x_;
+  x_ = rows;
+
+  delete[] column_dot_;
+  column_dot_ = new double[new_l];
+
+  if (x_square_ != NULL) {
+    double *x_square = new double[new_l];
+    std::copy(x_square_, x_square_+l, x_square);
+    delete[] x_square_;
+    x_square_ = x_square;
+    for (int i = l; i < new_l; ++i) {
+      x_square_[i] = Dot(i, i);
+    }
+  }
+
+  return;
+}
+
+// dense rows of x in the order of x, NULL if x is sparse or the kernel is precomputed
+DenseRows *Kernel::MakeDenseRows(int l, Node *const *x, const KernelParameter *param) {
+  if (param->kernel_type == PRECOMPUTED) {
+    return NULL;
+  }
+
+  int dim = GetDenseDim(x, l);
+  if (dim == 0) {
+    return NULL;
+  }
+  Info("Dense rows : %d features\n", dim);
+
+  return ::MakeDenseRows(x, l, dim);
+}
+
+// inverted index of the sparse rows x, NULL if the kernel is precomputed
+SparseIndex *Kernel::MakeSparseIndex(int l, Node *const *x, const KernelParameter *param) {
+  if (param->kernel_type == PRECOMPUTED) {
+    return NULL;
+  }
+
+  int max_index = 0;
+  for (int i = 0; i < l; ++i) {
+    for (const Node *px = x[i]; px->index != -1; ++px) {
+      max_index = std::max(max_index, px->index);
+    }
+  }
+
+  SparseIndex *index = new SparseIndex;
+  index->num_rows = l;
+  index->max_index = max_index;
+  index->start = new long[max_index+2];
+  std::fill(index->start, index->start+max_index+2, 0);
+  for (int i = 0; i < l; ++i) {
+    for (const Node *px = x[i]; px->index != -1; ++px) {
+      ++index->start[px->index+1];
+    }
+  }
+  for (int f = 0; f <= max_index; ++f) {
+    index->start[f+1] += index->start[f];
+  }
+  long num_nodes = index->start[max_index+1];
+  index->rows = new int[num_nodes];
+  index->values = new double[num_nodes];
+
+  long *next = new long[max_index+1];
+  std::copy(index->start, index->start+max_index+1, next);
+  for (int i = 0; i < l; ++i) {
+    for (const Node *px = x[i]; px->index != -1; ++px) {
+      long k = next[px->index]++;
+      index->rows[k] = i;
+      index->values[k] = px->value;
+    }
+  }
+  delete[] next;
+  Info("Sparse index : %ld non-zeros\n", num_nodes);
+
+  return index;
+}
+
+void FreeSparseIndex(struct SparseIndex *index) {
+  if (index == NULL) {
+    return;
+  }
+  delete[] index->start;
+  delete[] index->rows;
+  delete[] index->values;
+  delete index;
+
+  return;
+}
+
 Kernel::~Kernel() {
   delete[] x_;
   delete[] x_square_;
+  delete[] dense_x_;
+  delete[] index_row_;
+  delete[] dot_;
+  delete[] column_dot_;
+  FreeDenseRows(own_dense_);
+  FreeSparseIndex(own_index_);
 }
 
 void Kernel::SwapIndex(int i, int j) const {
@@ -166,6 +347,118 @@ void Kernel::SwapIndex(int i, int j) const {
   if (x_square_) {
     std::swap(x_square_[i], x_square_[j]);
   }
+  if (dense_x_) {
+    std::swap(dense_x_[i], dense_x_[j]);
+  }
+  if (index_row_) {
+    std::swap(index_row_[i], index_row_[j]);
+  }
+}
+
+// out[j] = kernel(dot[j], x_square, y_square[j]) for j in [0,len), y_square is only read if K::kSquares
+template <class K, class T>
+static void KernelValuesFromDots(const K &kernel, int len, const double *dot, double x_square, const double *y_square, T *out) {
+  for (int j = 0; j < len; ++j) {
+    out[j] = static_cast<T>(kernel(dot[j], x_square, K::kSquares ? y_square[j] : 0));
+  }
+}
+
+// single kernel evaluation K(x_i, x_j)
+double Kernel::KernelValue(int i, int j) const {
+  const KernelParameter param = { kernel_type_, degree_, gamma_, coef0_ };
+  switch (kernel_type_) {
+    case LINEAR: {
+      return LinearKernel(param)(Dot(i, j), 0, 0);
+    }
+    case POLY: {
+      return PolyKernel(param)(Dot(i, j), 0, 0);
+    }
+    case RBF: {
+      return RBFKernel(param)(Dot(i, j), x_square_[i], x_square_[j]);
+    }
+    case SIGMOID: {
+      return SigmoidKernel(param)(Dot(i, j), 0, 0);
+    }
+    case PRECOMPUTED: {
+      return x_[i][static_cast<int>(x_[j][0].value)].value;
+    }
+    default: {
+      // assert(false);
+      return 0;  // Unreachable
+    }
+  }
+}
+
+// the dot products of sparse data are accumulated over the inverted index into dot_ for all the rows
+// when it visits fewer nodes than merging x_i with each of the len rows of a column, returns whether it did
+bool Kernel::AccumulateDots(int i, int len) const {
+  if (index_ == NULL || len <= 0) {
+    return false;
+  }
+  long num_postings = 0;
+  long nnz = 0;
+  for (const Node *px = x_[i]; px->index != -1; ++px) {
+    num_postings += index_->start[px->index+1] - index_->start[px->index];
+    ++nnz;
+  }
+  long avg_nnz = index_->start[index_->max_index+1] / index_->num_rows;
+  if (num_postings+index_->num_rows >= static_cast<long>(len)*(nnz+avg_nnz)) {
+    return false;
+  }
+  std::fill(dot_, dot_+index_->num_rows, 0.0);
+  for (const Node *px = x_[i]; px->index != -1; ++px) {
+    for (long k = index_->start[px->index]; k < index_->start[px->index+1]; ++k) {
+      dot_[index_->rows[k]] += px->value * index_->values[k];
+    }
+  }
+
+  return true;
+}
+
+// dot[j] = <x_i, x_{start+j}> for j in [begin,end), read from dot_ if accumulated
+void Kernel::ColumnDots(int i, int start, int begin, int end, bool accumulated, double *dot) const {
+  if (accumulated) {
+    for (int j = begin; j < end; ++j) {
+      dot[j] = dot_[index_row_[start+j]];
+    }
+  } else if (dense_x_ != NULL) {
+    for (int j = begin; j < end; ++j) {
+      dot[j] = DotDense(dense_x_[i], dense_x_[start+j], dense_stride_);
+    }
+  } else {
+    for (int j = begin; j < end; ++j) {
+      dot[j] = Dot(x_[i], x_[start+j]);
+    }
+  }
+
+  return;
+}
+
+// data[j] = K(x_i, x_{start+j}) for j in [0,len), each part of [0,len) on a thread of pool_
+template <class K>
+void Kernel::FillColumn(int i, int start, int len, Qfloat *data) const {
+  const KernelParameter param = { kernel_type_, degree_, gamma_, coef0_ };
+  bool accumulated = AccumulateDots(i, len);
+  ParallelRange(pool_, len, [&](int, int begin, int end) {
+    ColumnDots(i, start, begin, end, accumulated, column_dot_);
+    if (K::kSquares) {
+      KernelValuesFromDots(K(param), end-begin, column_dot_+begin, x_square_[i], x_square_+start+begin, data+begin);
+    } else {
+      KernelValuesFromDots(K(param), end-begin, column_dot_+begin, 0, NULL, data+begin);
+    }
+  });
+
+  return;
+}
+
+void Kernel::FillColumnPrecomputed(int i, int start, int len, Qfloat *data) const {
+  ParallelRange(pool_, len, [&](int, int begin, int end) {
+    for (int j = begin; j < end; ++j) {
+      data[j] = static_cast<Qfloat>(x_[i][static_cast<int>(x_[start+j][0].value)].value);
+    }
+  });
+
+  return;
 }
 
 double Kernel::Dot(const Node *px, const Node *py) {
@@ -239,6 +532,129 @@ double Kernel::KernelFunction(const Node *x, const Node *y, const KernelParamete
   }
 }
 
+SVKernel::SVKernel(int l, Node *const *svs, const KernelParameter *param)
+    :l_(l),
+     svs_(svs),
+     param_(*param),
+     max_index_(0),
+     sv_square_(NULL),
+     dense_(NULL) {
+  switch (param_.kernel_type) {
+    case LINEAR: {
+      values_function_ = &SVKernel::FillValues<LinearKernel>;
+      break;
+    }
+    case POLY: {
+      values_function_ = &SVKernel::FillValues<PolyKernel>;
+      break;
+    }
+    case RBF: {
+      values_function_ = &SVKernel::FillValues<RBFKernel>;
+      break;
+    }
+    case SIGMOID: {
+      values_function_ = &SVKernel::FillValues<SigmoidKernel>;
+      break;
+    }
+    default: {
+      values_function_ = &SVKernel::FillValuesPrecomputed;
+      return;
+    }
+  }
+
+  for (int i = 0; i < l_; ++i) {
+    for (const Node *px = svs_[i]; px->index != -1; ++px) {
+      max_index_ = std::max(max_index_, px->index);
+    }
+  }
+
+  int dim = GetDenseDim(svs_, l_);
+  if (dim > 0) {
+    dense_ = MakeDenseRows(svs_, l_, dim);
+  }
+
+  if (param_.kernel_type == RBF) {
+    sv_square_ = new double[l_];
+    for (int i = 0; i < l_; ++i) {
+      if (dense_ != NULL) {
+        const double *row = dense_->data + static_cast<std::size_t>(i) * static_cast<std::size_t>(dense_->stride);
+        sv_square_[i] = DotDense(row, row, dense_->stride);
+      } else {
+        double sum = 0;
+        for (const Node *px = svs_[i]; px->index != -1; ++px) {
+          sum += px->value * px->value;
+        }
+        sv_square_[i] = sum;
+      }
+    }
+  }
+}
+
+SVKernel::~SVKernel() {
+  delete[] sv_square_;
+  FreeDenseRows(dense_);
+}
+
+// dot[i] = <x, svs[i]> for all the SVs
+void SVKernel::Dots(const Node *x, double *dot) const {
+  // x scattered over the features of the SVs, each thread keeps its own buffer, which is all zeros between calls
+  static thread_local std::vector<double> buffer;
+
+  if (dense_ != NULL && x->index >= 1) {
+    int stride = dense_->stride;
+    if (buffer.size() < static_cast<std::size_t>(stride)) {
+      buffer.resize(static_cast<std::size_t>(stride), 0.0);
+    }
+    ScatterDense(x, buffer.data(), dense_->dim, stride);
+    for (int i = 0; i < l_; ++i) {
+      dot[i] = DotDense(dense_->data + static_cast<std::size_t>(i) * static_cast<std::size_t>(stride), buffer.data(), stride);
+    }
+    std::fill(buffer.begin(), buffer.begin()+stride, 0.0);
+  } else {
+    if (buffer.size() < static_cast<std::size_t>(max_index_+1)) {
+      buffer.resize(static_cast<std::size_t>(max_index_+1), 0.0);
+    }
+    for (const Node *px = x; px->index != -1 && px->index <= max_index_; ++px) {
+      buffer[static_cast<std::size_t>(px->index)] = px->value;
+    }
+    for (int i = 0; i < l_; ++i) {
+      double sum = 0;
+      for (const Node *py = svs_[i]; py->index != -1; ++py) {
+        sum += buffer[static_cast<std::size_t>(py->index)] * py->value;
+      }
+      dot[i] = sum;
+    }
+    for (const Node *px = x; px->index != -1 && px->index <= max_index_; ++px) {
+      buffer[static_cast<std::size_t>(px->index)] = 0;
+    }
+  }
+
+  return;
+}
+
+// kvalue[i] = K(x, svs[i]) for all the SVs, computed from the dot products in one loop over all the SVs
+template <class K>
+void SVKernel::FillValues(const Node *x, double *kvalue) const {
+  Dots(x, kvalue);
+  double x_square = 0;
+  if (K::kSquares) {
+    for (const Node *px = x; px->index != -1; ++px) {
+      x_square += px->value * px->value;
+    }
+  }
+  KernelValuesFromDots(K(param_), l_, kvalue, x_square, sv_square_, kvalue);
+
+  return;
+}
+
+void SVKernel::FillValuesPrecomputed(const Node *x, double *kvalue) const {
+  for (int i = 0; i < l_; ++i) {
+    kvalue[i] = Kernel::KernelFunction(x, svs_[i], &param_);
+  }
+
+  return;
+}
+
 void Kernel::KernelText() {
   Info("Kernel : %s \n( degree = %d, gamma = %.10f, coef0 = %.10f )\n",
     kKernelTypeNameTable[kernel_type_], degree_, gamma_, coef0_);
@@ -3,7 +3,13 @@
 
 #include "utilities.h"
 
+// build with -DLIBVM_FLOAT_CACHE (make FLOAT_CACHE=1) to keep kernel columns in single precision,
+// which doubles the number of columns the cache holds for the same memory budget
+#ifdef LIBVM_FLOAT_CACHE
+typedef float Qfloat;
+#else
 typedef double Qfloat;
+#endif
 
 enum { LINEAR, POLY, RBF, SIGMOID, PRECOMPUTED };  // kernel_type
 
@@ -30,6 +36,8 @@ class Cache {
   // (p >= len if nothing needs to be filled)
   int get_data(const int index, Qfloat **data, int len);
   void SwapIndex(int i, int j);
+  // grow to l (>= the current number of) data items, keeping the cached data
+  void Grow(int l);
 
  private:
   int l_;
@@ -46,36 +54,127 @@ class Cache {
   void InsertLRU(Head *h);
 };
 
+//
+// Inverted index of sparse rows
+//
+// the rows having feature f are rows[start[f],start[f+1]) in increasing order,
+// and values[k] is the value of feature f in row rows[k]
+//
+struct SparseIndex {
+  int num_rows;
+  int max_index;
+  long *start;
+  int *rows;
+  double *values;
+};
+
+void FreeSparseIndex(struct SparseIndex *index);
+
+//
+// Kernel types as policy classes
+//
+// operator() turns the dot product of x and y (and their squared norms if kSquares) into the kernel value,
+// the loops over a column of the kernel matrix and over the SVs of a model are instantiated for each of them
+//
+struct LinearKernel {
+  static const bool kSquares = false;
+  explicit LinearKernel(const KernelParameter &) {}
+  double operator()(double dot, double, double) const {
+    return dot;
+  }
+};
+
+struct PolyKernel {
+  static const bool kSquares = false;
+  explicit PolyKernel(const KernelParameter &param) : degree(param.degree), gamma(param.gamma), coef0(param.coef0) {}
+  double operator()(double dot, double, double) const {
+    return std::pow(gamma*dot+coef0, degree);
+  }
+  int degree;
+  double gamma;
+  double coef0;
+};
+
+struct RBFKernel {
+  static const bool kSquares = true;
+  explicit RBFKernel(const KernelParameter &param) : gamma(param.gamma) {}
+  double operator()(double dot, double x_square, double y_square) const {
+    return exp(-gamma*(x_square+y_square-2*dot));
+  }
+  double gamma;
+};
+
+struct SigmoidKernel {
+  static const bool kSquares = false;
+  explicit SigmoidKernel(const KernelParameter &param) : gamma(param.gamma), coef0(param.coef0) {}
+  double operator()(double dot, double, double) const {
+    return tanh(gamma*dot+coef0);
+  }
+  double gamma;
+  double coef0;
+};
+
 //
 // Kernel evaluation
 //
 // the static method KernelFunction is for doing single kernel evaluation
-// the constructor of Kernel prepares to calculate the l*l kernel matrix
-// the member function get_Q is for getting one column from the Q Matrix
+// the constructor of Kernel prepares to calculate the l*l kernel matrix, the dot products of dense data
+// run over a dense copy of the rows, and the columns of sparse data are accumulated over an inverted index
+// of the rows, which the second constructor shares with other kernels (a kernel made by it with neither of
+// them can grow with the training set by AppendRows)
+// the member function get_Q is for getting one column from the Q Matrix, KernelColumn computes the dot
+// products of a column first and then the kernel values in a loop instantiated for the kernel type,
+// split over the threads of a worker pool if one is set
 //
 class QMatrix {
  public:
   virtual Qfloat *get_Q(int column, int len) const = 0;
   virtual double *get_QD() const = 0;
   virtual void SwapIndex(int i, int j) const = 0;
+  virtual WorkerPool *get_pool() const {
+    return NULL;
+  }
   virtual ~QMatrix() {}
 };
 
 class Kernel : public QMatrix {
  public:
   Kernel(int l, Node *const *x, const KernelParameter *param);
+  Kernel(int l, Node *const *x, const KernelParameter *param, const DenseRows *dense, const SparseIndex *index);
   virtual ~Kernel();
   static double KernelFunction(const Node *x, const Node *y, const KernelParameter *param);
+  static DenseRows *MakeDenseRows(int l, Node *const *x, const KernelParameter *param);
+  static SparseIndex *MakeSparseIndex(int l, Node *const *x, const KernelParameter *param);
   virtual Qfloat *get_Q(int column, int len) const = 0;
   virtual double *get_QD() const = 0;
   virtual void SwapIndex(int i, int j) const;
+  WorkerPool *get_pool() const {
+    return pool_;
+  }
+  void set_pool(WorkerPool *pool) {
+    pool_ = pool;
+  }
 
  protected:
-  double (Kernel::*kernel_function)(int i, int j) const;
+  double KernelValue(int i, int j) const;
+  void AppendRows(int l, int new_l, Node *const *x);
+  void KernelColumn(int i, int start, int len, Qfloat *data) const {
+    (this->*column_function_)(i, start, len, data);
+  }
 
  private:
   const Node **x_;
   double *x_square_;
+  const double **dense_x_;  // rows of dense data, NULL for sparse data
+  int dense_stride_;
+  DenseRows *own_dense_;  // NULL if the dense rows are shared by other kernels
+  const SparseIndex *index_;  // inverted index of sparse data, NULL for dense data
+  SparseIndex *own_index_;  // NULL if the index is shared by other kernels
+  int *index_row_;  // row of x_i in index_
+  double *dot_;  // dot products accumulated over index_
+  double *column_dot_;  // dot products of the column being computed
+  void (Kernel::*column_function_)(int i, int start, int len, Qfloat *data) const;
+  WorkerPool *pool_;  // NULL to compute the columns on the calling thread
 
   // KernelParameter
   const int kernel_type_;
@@ -84,24 +183,45 @@ class Kernel : public QMatrix {
   const double coef0_;
 
   static double Dot(const Node *px, const Node *py);
-  double KernelLinear(int i, int j) const {
-    return Dot(x_[i], x_[j]);
-  }
-  double KernelPoly(int i, int j) const {
-    return std::pow(gamma_*Dot(x_[i], x_[j])+coef0_, degree_);
-  }
-  double KernelRBF(int i, int j) const {
-    return exp(-gamma_*(x_square_[i]+x_square_[j]-2*Dot(x_[i], x_[j])));
-  }
-  double KernelSigmoid(int i, int j) const {
-    return tanh(gamma_*Dot(x_[i], x_[j])+coef0_);
-  }
-  double KernelPrecomputed(int i, int j) const {
-    return x_[i][static_cast<int>(x_[j][0].value)].value;
+  double Dot(int i, int j) const {
+    return (dense_x_ != NULL) ? DotDense(dense_x_[i], dense_x_[j], dense_stride_) : Dot(x_[i], x_[j]);
   }
+  bool AccumulateDots(int i, int len) const;
+  void ColumnDots(int i, int start, int begin, int end, bool accumulated, double *dot) const;
+  template <class K> void FillColumn(int i, int start, int len, Qfloat *data) const;
+  void FillColumnPrecomputed(int i, int start, int len, Qfloat *data) const;
+  void Init(int l, Node *const *x, const DenseRows *dense, const SparseIndex *index);
   void KernelText();
 };
 
+//
+// Kernel values between an example and the SVs of a model
+//
+// the squared norms of the SVs (and a dense copy of dense SVs) are prepared once when the model is
+// trained or loaded, KernelValues scatters x once and evaluates the kernels with all the SVs in one pass
+//
+class SVKernel {
+ public:
+  SVKernel(int l, Node *const *svs, const KernelParameter *param);
+  ~SVKernel();
+  void KernelValues(const Node *x, double *kvalue) const {
+    (this->*values_function_)(x, kvalue);
+  }
+
+ private:
+  int l_;
+  Node *const *svs_;
+  KernelParameter param_;
+  int max_index_;  // largest feature index of the SVs
+  double *sv_square_;  // for rbf
+  DenseRows *dense_;  // NULL for sparse SVs
+  void (SVKernel::*values_function_)(const Node *x, double *kvalue) const;
+
+  void Dots(const Node *x, double *dot) const;
+  template <class K> void FillValues(const Node *x, double *kvalue) const;
+  void FillValuesPrecomputed(const Node *x, double *kvalue) const;
+};
+
 void InitKernelParam(struct KernelParameter *param);
 const char *CheckKernelParameter(const struct KernelParameter *param);
 
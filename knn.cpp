@@ -1,6 +1,9 @@
 #include "knn.h"
 #include <cmath>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
 
 double CalcDist(const struct Node *x1, const struct Node *x2) {
   double sum = 0;
@@ -53,12 +56,366 @@ int CompareDist(double *neighbors, double dist, int num_neighbors) {
   return i;
 }
 
+// slack on the triangle inequality bounds, so rounding errors never prune a true neighbour
+static const double kVPTreeSlack = 1e-12;
+
+static inline bool CanPrune(double lower_bound, double bound, double scale) {
+  return lower_bound > bound + kVPTreeSlack * scale;
+}
+
+static inline void InsertNeighbor(double *dist_neighbors, int *index_neighbors, int num_neighbors, double dist, int index) {
+  int i = num_neighbors;
+  while (i > 0 && (dist < dist_neighbors[i-1] ||
+                   (dist == dist_neighbors[i-1] && index < index_neighbors[i-1]))) {
+    --i;
+  }
+  if (i == num_neighbors) {
+    return;
+  }
+  for (int j = num_neighbors-1; j > i; --j) {
+    dist_neighbors[j] = dist_neighbors[j-1];
+    index_neighbors[j] = index_neighbors[j-1];
+  }
+  dist_neighbors[i] = dist;
+  index_neighbors[i] = index;
+
+  return;
+}
+
+VPTree::VPTree(int l, Node *const *x) : l_(l), radius_(NULL), dense_(NULL) {
+  clone(x_, x, l);
+
+  int dim = GetDenseDim(x, l);
+  if (dim > 0) {
+    dense_ = MakeDenseRows(x, l, dim);
+  }
+
+  std::vector<std::pair<double, int> > items(static_cast<std::size_t>(l));
+  for (int i = 0; i < l; ++i) {
+    items[static_cast<std::size_t>(i)] = std::make_pair(0.0, i);
+  }
+  nodes_.reserve(static_cast<std::size_t>(l));
+  Build(items, 0, l);
+}
+
+VPTree::~VPTree() {
+  delete[] x_;
+  delete[] radius_;
+  FreeDenseRows(dense_);
+}
+
+void VPTree::MakeQuery(const Node *x, Query &query) const {
+  query.x = x;
+  query.dense.clear();
+  if (dense_ != NULL && (x->index == -1 || x->index >= 1)) {
+    query.dense.resize(static_cast<std::size_t>(dense_->stride));
+    query.tail = ScatterDense(x, query.dense.data(), dense_->dim, dense_->stride);
+  }
+
+  return;
+}
+
+double VPTree::Dist(int i, const Query &query) const {
+  if (query.dense.empty()) {
+    return CalcDist(x_[i], query.x);
+  }
+
+  std::size_t stride = static_cast<std::size_t>(dense_->stride);
+  double sum = SquaredDistDense(dense_->data + static_cast<std::size_t>(i) * stride, query.dense.data(), dense_->stride);
+  for (const Node *p = query.tail; p->index != -1; ++p) {
+    sum += p->value * p->value;
+  }
+
+  return sqrt(sum);
+}
+
+double VPTree::Dist(int i, int j) const {
+  if (dense_ == NULL) {
+    return CalcDist(x_[i], x_[j]);
+  }
+
+  std::size_t stride = static_cast<std::size_t>(dense_->stride);
+  return sqrt(SquaredDistDense(dense_->data + static_cast<std::size_t>(i) * stride,
+                               dense_->data + static_cast<std::size_t>(j) * stride, dense_->stride));
+}
+
+int VPTree::Build(std::vector<std::pair<double, int> > &items, int begin, int end) {
+  if (begin >= end) {
+    return -1;
+  }
+
+  // take the middle example as vantage point, the order of items is arbitrary below the root
+  std::swap(items[static_cast<std::size_t>(begin)], items[static_cast<std::size_t>(begin+(end-begin)/2)]);
+
+  int id = static_cast<int>(nodes_.size());
+  VPNode node;
+  node.index = items[static_cast<std::size_t>(begin)].second;
+  node.inside = -1;
+  node.outside = -1;
+  node.threshold = 0;
+  node.max_radius = kInf;
+  nodes_.push_back(node);
+
+  if (end - begin > 1) {
+    for (int i = begin+1; i < end; ++i) {
+      items[static_cast<std::size_t>(i)].first = Dist(node.index, items[static_cast<std::size_t>(i)].second);
+    }
+    int mid = (begin + 1 + end) / 2;
+    std::nth_element(items.begin()+begin+1, items.begin()+mid, items.begin()+end);
+    nodes_[static_cast<std::size_t>(id)].threshold = items[static_cast<std::size_t>(mid)].first;
+
+    int inside = Build(items, begin+1, mid);
+    int outside = Build(items, mid, end);
+    nodes_[static_cast<std::size_t>(id)].inside = inside;
+    nodes_[static_cast<std::size_t>(id)].outside = outside;
+  }
+
+  return id;
+}
+
+int VPTree::Search(const Node *x, int num_neighbors, int exclude, double *dist_neighbors, int *index_neighbors) const {
+  for (int i = 0; i < num_neighbors; ++i) {
+    dist_neighbors[i] = kInf;
+    index_neighbors[i] = -1;
+  }
+  Query query;
+  MakeQuery(x, query);
+  SearchNode(nodes_.empty() ? -1 : 0, query, num_neighbors, exclude, dist_neighbors, index_neighbors);
+
+  int num_found = 0;
+  while (num_found < num_neighbors && index_neighbors[num_found] != -1) {
+    ++num_found;
+  }
+
+  return num_found;
+}
+
+void VPTree::SearchNode(int id, const Query &query, int num_neighbors, int exclude, double *dist_neighbors, int *index_neighbors) const {
+  if (id == -1) {
+    return;
+  }
+
+  const VPNode &node = nodes_[static_cast<std::size_t>(id)];
+  double dist = Dist(node.index, query);
+  if (node.index != exclude) {
+    InsertNeighbor(dist_neighbors, index_neighbors, num_neighbors, dist, node.index);
+  }
+
+  double scale = dist + node.threshold;
+  if (dist <= node.threshold) {
+    SearchNode(node.inside, query, num_neighbors, exclude, dist_neighbors, index_neighbors);
+    if (!CanPrune(node.threshold-dist, dist_neighbors[num_neighbors-1], scale)) {
+      SearchNode(node.outside, query, num_neighbors, exclude, dist_neighbors, index_neighbors);
+    }
+  } else {
+    SearchNode(node.outside, query, num_neighbors, exclude, dist_neighbors, index_neighbors);
+    if (!CanPrune(dist-node.threshold, dist_neighbors[num_neighbors-1], scale)) {
+      SearchNode(node.inside, query, num_neighbors, exclude, dist_neighbors, index_neighbors);
+    }
+  }
+
+  return;
+}
+
+void VPTree::SetRadius(const double *radius) {
+  if (radius_ == NULL) {
+    radius_ = new double[l_];
+  }
+  std::copy(radius, radius+l_, radius_);
+
+  // children are always stored after their parents
+  for (std::size_t i = nodes_.size(); i-- > 0; ) {
+    VPNode &node = nodes_[i];
+    node.max_radius = radius_[node.index];
+    if (node.inside != -1) {
+      node.max_radius = std::max(node.max_radius, nodes_[static_cast<std::size_t>(node.inside)].max_radius);
+    }
+    if (node.outside != -1) {
+      node.max_radius = std::max(node.max_radius, nodes_[static_cast<std::size_t>(node.outside)].max_radius);
+    }
+  }
+
+  return;
+}
+
+void VPTree::SearchReverse(const Node *x, std::vector<int> &indices, std::vector<double> &dists) const {
+  indices.clear();
+  dists.clear();
+  if (radius_ != NULL && !nodes_.empty()) {
+    Query query;
+    MakeQuery(x, query);
+    SearchReverseNode(0, query, indices, dists);
+  }
+
+  return;
+}
+
+void VPTree::SearchReverseNode(int id, const Query &query, std::vector<int> &indices, std::vector<double> &dists) const {
+  const VPNode &node = nodes_[static_cast<std::size_t>(id)];
+  double dist = Dist(node.index, query);
+  if (dist < radius_[node.index]) {
+    indices.push_back(node.index);
+    dists.push_back(dist);
+  }
+
+  double scale = dist + node.threshold;
+  if (node.inside != -1 &&
+      !CanPrune(dist-node.threshold, nodes_[static_cast<std::size_t>(node.inside)].max_radius, scale)) {
+    SearchReverseNode(node.inside, query, indices, dists);
+  }
+  if (node.outside != -1 &&
+      !CanPrune(node.threshold-dist, nodes_[static_cast<std::size_t>(node.outside)].max_radius, scale)) {
+    SearchReverseNode(node.outside, query, indices, dists);
+  }
+
+  return;
+}
+
+// VPTree end
+
+// largest number of rows in each block of the all-pairs distance matrix
+static const int kKNNBlockSize = 256;
+// largest index for which the rows are scattered into a dense array for the dot products
+static const int kKNNMaxDenseIndex = 1 << 16;
+
+// <x, y> by merging the sparse rows, for data whose indices are too large for a dense array
+static inline double SparseDot(const Node *x, const Node *y) {
+  double sum = 0;
+  while (x->index != -1 && y->index != -1) {
+    if (x->index == y->index) {
+      sum += x->value * y->value;
+      ++x;
+      ++y;
+    } else if (x->index > y->index) {
+      ++y;
+    } else {
+      ++x;
+    }
+  }
+
+  return sum;
+}
+
+// Blocked all-pairs search over the upper triangle of the distance matrix. The tiles
+// (block_a, block_b) are run in rounds in which no two tiles share a block (the circle
+// method of round-robin tournaments, and a last round of the diagonal tiles), so each
+// tile inserts the neighbours of both of its blocks into dist_neighbors/index_neighbors
+// directly, with no other memory than O(num_ex) and a dense row of at most
+// kKNNMaxDenseIndex values for each thread. The distances are estimated by the squared
+// norms and the dot products, and a pair is only passed to CalcDist if the estimate,
+// less a bound on the rounding errors, could enter the top-K list of either row, so the
+// neighbours are the same as those of the exact search, ties included.
+static void SearchAllPairs(const struct Problem *prob, int num_neighbors, int num_threads, double **dist_neighbors, int *index_neighbors) {
+  int num_ex = prob->num_ex;
+  int max_index = 0;
+  double *x_square = new double[num_ex];
+  int *x_nnz = new int[num_ex];
+
+  for (int i = 0; i < num_ex; ++i) {
+    x_square[i] = 0;
+    x_nnz[i] = 0;
+    for (const Node *p = prob->x[i]; p->index != -1; ++p) {
+      x_square[i] += p->value * p->value;
+      ++x_nnz[i];
+      max_index = std::max(max_index, p->index);
+    }
+    for (int j = 0; j < num_neighbors; ++j) {
+      dist_neighbors[i][j] = kInf;
+      index_neighbors[static_cast<std::size_t>(i) * static_cast<std::size_t>(num_neighbors) + static_cast<std::size_t>(j)] = -1;
+    }
+  }
+
+  // the blocks are made small enough that every round has a tile for each thread
+  num_threads = GetNumThreads(num_threads);
+  int block_size = std::max(1, std::min(kKNNBlockSize, num_ex / (2*num_threads)));
+  int num_blocks = (num_ex + block_size - 1) / block_size;
+  int num_slots = num_blocks + num_blocks % 2;  // with an empty block if num_blocks is odd
+  num_threads = std::max(1, std::min(num_threads, num_slots / 2));
+
+  std::size_t dense_size = (max_index < kKNNMaxDenseIndex) ? static_cast<std::size_t>(max_index) + 1 : 0;
+  double *dense = NULL;
+  if (dense_size > 0) {
+    dense = new double[static_cast<std::size_t>(num_threads) * dense_size];
+    std::fill(dense, dense + static_cast<std::size_t>(num_threads) * dense_size, 0.0);
+  }
+
+  auto run_tile = [&](int a, int b, int thread) {
+    double *x_dense = (dense != NULL) ? dense + static_cast<std::size_t>(thread) * dense_size : NULL;
+    int end_i = std::min((a+1) * block_size, num_ex);
+    int end_j = std::min((b+1) * block_size, num_ex);
+
+    for (int i = a * block_size; i < end_i; ++i) {
+      if (x_dense != NULL) {
+        for (const Node *p = prob->x[i]; p->index != -1; ++p) {
+          x_dense[p->index] = p->value;
+        }
+      }
+      int *index_i = index_neighbors + static_cast<std::size_t>(i) * static_cast<std::size_t>(num_neighbors);
+      for (int j = (a == b) ? i+1 : b * block_size; j < end_j; ++j) {
+        double dot = 0;
+        if (x_dense != NULL) {
+          for (const Node *p = prob->x[j]; p->index != -1; ++p) {
+            dot += x_dense[p->index] * p->value;
+          }
+        } else {
+          dot = SparseDot(prob->x[i], prob->x[j]);
+        }
+        // the rounding errors of the norms, the dot product and the sum of CalcDist are all within this bound
+        double error = 4 * (x_nnz[i] + x_nnz[j] + 4) * DBL_EPSILON * (x_square[i] + x_square[j] + 2 * std::fabs(dot));
+        double lower = x_square[i] + x_square[j] - 2*dot - error;
+        double kth_i = dist_neighbors[i][num_neighbors-1];
+        double kth_j = dist_neighbors[j][num_neighbors-1];
+        if (lower <= kth_i * kth_i || lower <= kth_j * kth_j) {
+          double dist = CalcDist(prob->x[i], prob->x[j]);
+          InsertNeighbor(dist_neighbors[i], index_i, num_neighbors, dist, j);
+          InsertNeighbor(dist_neighbors[j], index_neighbors + static_cast<std::size_t>(j) * static_cast<std::size_t>(num_neighbors),
+                         num_neighbors, dist, i);
+        }
+      }
+      if (x_dense != NULL) {
+        for (const Node *p = prob->x[i]; p->index != -1; ++p) {
+          x_dense[p->index] = 0;
+        }
+      }
+    }
+  };
+
+  // round r < num_slots-1 pairs slot num_slots-1 with r, and (r+k, r-k) mod (num_slots-1) for the other k,
+  // round num_slots-1 runs the diagonal tiles
+  WorkerPool pool(num_threads);
+  for (int r = 0; r < num_slots; ++r) {
+    std::atomic<int> next_tile(0);
+    int num_tiles = (r < num_slots-1) ? num_slots / 2 : num_blocks;
+    pool.Run([&](int thread) {
+      for (int t = next_tile++; t < num_tiles; t = next_tile++) {
+        int a = t, b = t;
+        if (r < num_slots-1) {
+          a = (t == 0) ? num_slots-1 : (r + t) % (num_slots-1);
+          b = (t == 0) ? r : (r - t + num_slots-1) % (num_slots-1);
+        }
+        if (a < num_blocks && b < num_blocks) {
+          run_tile(std::min(a, b), std::max(a, b), thread);
+        }
+      }
+    });
+  }
+
+  delete[] x_square;
+  delete[] x_nnz;
+  if (dense != NULL) {
+    delete[] dense;
+  }
+
+  return;
+}
+
 KNNModel *TrainKNN(const struct Problem *prob, const struct KNNParameter *param) {
   KNNModel *model = new KNNModel;
   model->param = *param;
   model->labels = NULL;
   model->dist_neighbors = NULL;
   model->label_neighbors = NULL;
+  model->tree = NULL;
 
   int num_classes = 0;
   int num_ex = prob->num_ex;
@@ -101,19 +458,33 @@ KNNModel *TrainKNN(const struct Problem *prob, const struct KNNParameter *param)
     }
   }
 
-  for (int i = 0; i < num_ex-1; ++i) {
-    for (int j = i+1; j < num_ex; ++j) {
-      double dist = CalcDist(prob->x[i], prob->x[j]);
-      int index;
-      index = CompareDist(dist_neighbors[i], dist, num_neighbors);
-      if (index < num_neighbors) {
-        InsertLabel(label_neighbors[i], alter_labels[j], num_neighbors, index);
+  if (param->search_type == VP_TREE) {
+    VPTree *tree = new VPTree(num_ex, prob->x);
+    int *index_neighbors = new int[num_neighbors];
+
+    for (int i = 0; i < num_ex; ++i) {
+      tree->Search(prob->x[i], num_neighbors, i, dist_neighbors[i], index_neighbors);
+      for (int j = 0; j < num_neighbors; ++j) {
+        if (index_neighbors[j] != -1) {
+          label_neighbors[i][j] = alter_labels[index_neighbors[j]];
+        }
       }
-      index = CompareDist(dist_neighbors[j], dist, num_neighbors);
-      if (index < num_neighbors) {
-        InsertLabel(label_neighbors[j], alter_labels[i], num_neighbors, index);
+    }
+    delete[] index_neighbors;
+    model->tree = tree;
+  } else {
+    int *index_neighbors = new int[static_cast<std::size_t>(num_ex) * static_cast<std::size_t>(num_neighbors)];
+
+    SearchAllPairs(prob, num_neighbors, param->num_threads, dist_neighbors, index_neighbors);
+    for (int i = 0; i < num_ex; ++i) {
+      for (int j = 0; j < num_neighbors; ++j) {
+        int index = index_neighbors[static_cast<std::size_t>(i) * static_cast<std::size_t>(num_neighbors) + static_cast<std::size_t>(j)];
+        if (index != -1) {
+          label_neighbors[i][j] = alter_labels[index];
+        }
       }
     }
+    delete[] index_neighbors;
   }
   delete[] alter_labels;
 
@@ -124,10 +495,38 @@ KNNModel *TrainKNN(const struct Problem *prob, const struct KNNParameter *param)
   model->label_neighbors = label_neighbors;
   model->param = *param;
 
+  if (model->tree != NULL) {
+    double *radius = new double[num_ex];
+    for (int i = 0; i < num_ex; ++i) {
+      radius[i] = dist_neighbors[i][num_neighbors-1];
+    }
+    model->tree->SetRadius(radius);
+    delete[] radius;
+  }
+
   return model;
 }
 
-double PredictKNN(struct Problem *train, struct Node *x, const int num_neighbors) {
+void BuildKNNIndex(struct KNNModel *model, const struct Problem *prob) {
+  if (model->tree != NULL) {
+    delete model->tree;
+  }
+  model->tree = new VPTree(prob->num_ex, prob->x);
+
+  if (model->dist_neighbors != NULL) {
+    int num_neighbors = model->param.num_neighbors;
+    double *radius = new double[prob->num_ex];
+    for (int i = 0; i < prob->num_ex; ++i) {
+      radius[i] = model->dist_neighbors[i][num_neighbors-1];
+    }
+    model->tree->SetRadius(radius);
+    delete[] radius;
+  }
+
+  return;
+}
+
+double PredictKNN(const struct Problem *train, const struct Node *x, const int num_neighbors) {
   double neighbors[num_neighbors];
   double labels[num_neighbors];
 
@@ -147,6 +546,30 @@ double PredictKNN(struct Problem *train, struct Node *x, const int num_neighbors
   return predict_label;
 }
 
+double PredictKNN(const struct Problem *train, const struct KNNModel *model, const struct Node *x) {
+  int num_neighbors = model->param.num_neighbors;
+
+  if (model->tree == NULL) {
+    return PredictKNN(train, x, num_neighbors);
+  }
+
+  double neighbors[num_neighbors];
+  double labels[num_neighbors];
+  int index_neighbors[num_neighbors];
+
+  model->tree->Search(x, num_neighbors, -1, neighbors, index_neighbors);
+  for (int i = 0; i < num_neighbors; ++i) {
+    if (index_neighbors[i] != -1) {
+      labels[i] = train->y[index_neighbors[i]];
+    } else {
+      labels[i] = -1;
+    }
+  }
+  double predict_label = FindMostFrequent(labels, num_neighbors);
+
+  return predict_label;
+}
+
 int SaveKNNModel(std::ofstream &model_file, const struct KNNModel *model) {
   model_file << "knn_model\n";
   model_file << "num_examples " << model->num_ex << '\n';
@@ -187,6 +610,12 @@ int SaveKNNModel(std::ofstream &model_file, const struct KNNModel *model) {
 KNNModel *LoadKNNModel(std::ifstream &model_file) {
   KNNModel *model = new KNNModel;
   KNNParameter &param = model->param;
+  param.search_type = VP_TREE;
+  param.num_threads = 1;
+  model->labels = NULL;
+  model->dist_neighbors = NULL;
+  model->label_neighbors = NULL;
+  model->tree = NULL;
 
   char cmd[80];
   while (1) {
@@ -262,6 +691,11 @@ void FreeKNNModel(struct KNNModel *model) {
     model->label_neighbors = NULL;
   }
 
+  if (model->tree != NULL) {
+    delete model->tree;
+    model->tree = NULL;
+  }
+
   if (model != NULL) {
     delete model;
     model = NULL;
@@ -276,6 +710,8 @@ void FreeKNNParam(struct KNNParameter *param) {
 
 void InitKNNParam(struct KNNParameter *param) {
   param->num_neighbors = 1;
+  param->search_type = VP_TREE;
+  param->num_threads = 1;
 
   return;
 }
@@ -285,5 +721,14 @@ const char *CheckKNNParameter(const struct KNNParameter *param) {
     return "num_neighbors should be greater than 0";
   }
 
+  if (param->search_type != BRUTE_FORCE &&
+      param->search_type != VP_TREE) {
+    return "unknown search type";
+  }
+
+  if (param->num_threads < 0) {
+    return "num_threads should not be less than 0";
+  }
+
   return NULL;
 }
\ No newline at end of file
@@ -3,8 +3,60 @@
 
 #include "utilities.h"
 
+enum { BRUTE_FORCE, VP_TREE };  // search_type
+
 struct KNNParameter {
   int num_neighbors;
+  int search_type;
+  int num_threads;  // for BRUTE_FORCE, 0 for all cores
+};
+
+//
+// Vantage-point tree
+//
+// an exact metric index over the training examples, built once per training set
+// Search returns the K nearest neighbours ordered by (distance, index), which is
+// the same order as inserting all examples one by one with CompareDist
+// SearchReverse returns the examples whose radius (distance to their K-th neighbour) is greater than the distance to x
+// for dense data the distances are computed on a dense copy of the examples, in the same order of indices as CalcDist
+//
+class VPTree {
+ public:
+  VPTree(int l, Node *const *x);
+  ~VPTree();
+
+  int Search(const Node *x, int num_neighbors, int exclude, double *dist_neighbors, int *index_neighbors) const;
+  void SetRadius(const double *radius);
+  void SearchReverse(const Node *x, std::vector<int> &indices, std::vector<double> &dists) const;
+
+ private:
+  struct VPNode {
+    int index;  // vantage point
+    int inside;  // examples with distance <= threshold, -1 if empty
+    int outside;  // examples with distance >= threshold, -1 if empty
+    double threshold;
+    double max_radius;  // largest radius in this subtree
+  };
+
+  // a query example, with its dense copy for dense data
+  struct Query {
+    const Node *x;
+    std::vector<double> dense;
+    const Node *tail;  // nodes of x beyond the dense dimension
+  };
+
+  int l_;
+  const Node **x_;
+  double *radius_;
+  DenseRows *dense_;  // NULL for sparse data
+  std::vector<VPNode> nodes_;
+
+  void MakeQuery(const Node *x, Query &query) const;
+  double Dist(int i, const Query &query) const;
+  double Dist(int i, int j) const;
+  int Build(std::vector<std::pair<double, int> > &items, int begin, int end);
+  void SearchNode(int id, const Query &query, int num_neighbors, int exclude, double *dist_neighbors, int *index_neighbors) const;
+  void SearchReverseNode(int id, const Query &query, std::vector<int> &indices, std::vector<double> &dists) const;
 };
 
 struct KNNModel {
@@ -14,6 +66,7 @@ struct KNNModel {
   int *labels;  // label of each class (label[k])
   double **dist_neighbors;
   int **label_neighbors;
+  class VPTree *tree;  // NULL for brute force search
 };
 
 template <typename T>
@@ -26,7 +79,9 @@ static inline void InsertLabel(T *labels, T label, int num_neighbors, int index)
 }
 
 KNNModel *TrainKNN(const struct Problem *prob, const struct KNNParameter *param);
-double PredictKNN(struct Problem *train, struct Node *x, const int num_neighbors);
+void BuildKNNIndex(struct KNNModel *model, const struct Problem *prob);
+double PredictKNN(const struct Problem *train, const struct Node *x, const int num_neighbors);
+double PredictKNN(const struct Problem *train, const struct KNNModel *model, const struct Node *x);
 double CalcDist(const struct Node *x1, const struct Node *x2);
 int CompareDist(double *neighbors, double dist, int num_neighbors);
 
@@ -324,19 +324,33 @@ int RedOpt::GetMarginError(const double beta) {
 
 class SPOC_Q : public Kernel {
  public:
-  SPOC_Q(const Problem &prob, const MCSVMParameter &param) : Kernel(prob.num_ex, prob.x, param.kernel_param) {
+  SPOC_Q(const Problem &prob, const MCSVMParameter &param, const DenseRows *dense, const SparseIndex *index)
+      : Kernel(prob.num_ex, prob.x, param.kernel_param, dense, index), l_(prob.num_ex) {
     cache_ = new Cache(prob.num_ex, static_cast<long>(param.cache_size*(1<<20)));
     QD_ = new double[prob.num_ex];
     for (int i = 0; i < prob.num_ex; ++i)
-      QD_[i] = (this->*kernel_function)(i, i);
+      QD_[i] = KernelValue(i, i);
+  }
+
+  // appends the rows x[l,new_l) to a SPOC_Q made with neither dense rows nor an inverted index,
+  // the cached columns are kept and filled up to new_l when they are read again
+  void Grow(int new_l, Node *const *x) {
+    AppendRows(l_, new_l, x);
+    cache_->Grow(new_l);
+    double *QD = new double[new_l];
+    std::copy(QD_, QD_+l_, QD);
+    delete[] QD_;
+    QD_ = QD;
+    for (int i = l_; i < new_l; ++i)
+      QD_[i] = KernelValue(i, i);
+    l_ = new_l;
   }
 
   Qfloat *get_Q(int i, int len) const {
     Qfloat *data;
     int start = cache_->get_data(i, &data, len);
     if (start < len) {
-      for (int j = start; j < len; ++j)
-        data[j] = static_cast<Qfloat>((this->*kernel_function)(i, j));
+      KernelColumn(i, start, len-start, data+start);
     }
     return data;
   }
@@ -357,6 +371,7 @@ class SPOC_Q : public Kernel {
   }
 
  private:
+  int l_;
   Cache *cache_;
   double *QD_;  // Q matrix Diagonal
 };
@@ -367,7 +382,7 @@ class SPOC_Q : public Kernel {
 
 class Spoc {
  public:
-  Spoc(const Problem *prob, const MCSVMParameter *param, int *y, int num_classes);
+  Spoc(const Problem *prob, const MCSVMParameter *param, const int *y, int num_classes, const double *const *init_tau, bool incremental);
   virtual ~Spoc();
 
   struct SolutionInfo {
@@ -378,6 +393,7 @@ class Spoc {
   };
 
   Spoc::SolutionInfo *Solve();
+  void Grow(const Problem *prob, const int *y, int num_classes);
 
  protected:
 
@@ -406,10 +422,14 @@ class Spoc {
   double **tau_;
   SPOC_Q *spoc_Q_;
   RedOpt *red_opt_;
+  MCSVMParameter param_;
+  DenseRows *dense_;
+  SparseIndex *sparse_index_;
 
+  void InitPatterns();
   void CalcEpsilon(double epsilon);
   void ChooseNextPattern(int *pattern_list, int num_patterns);
-  void UpdateMatrix(double *kernel_next_p);
+  void UpdateMatrix(const Qfloat *kernel_next_p);
   double CalcTrainError(double beta);
   int CountNumSVs();
 
@@ -429,16 +449,18 @@ class Spoc {
 
 };
 
-Spoc::Spoc(const Problem *prob, const MCSVMParameter *param, int *y, int num_classes)
+// init_tau (NULL for a cold start) is a feasible tau[num_ex][num_classes] to warm start from,
+// an incremental Spoc computes its kernel with neither dense rows nor an inverted index, so that it can Grow
+Spoc::Spoc(const Problem *prob, const MCSVMParameter *param, const int *y, int num_classes, const double *const *init_tau, bool incremental)
     :epsilon_(param->epsilon),
      epsilon0_(param->epsilon0),
      iteration_(12),
      num_ex_(prob->num_ex),
      num_classes_(num_classes),
      next_p_list_(0),
-     y_(y),
      max_psi_(0),
-     beta_(param->beta) {
+     beta_(param->beta),
+     param_(*param) {
 
   Info("\nOptimizer (SPOC) ... start\n");
   Info("Initializing ... start\n");
@@ -446,6 +468,9 @@ Spoc::Spoc(const Problem *prob, const MCSVMParameter *param, int *y, int num_cla
   Info("Requested margin (beta) %e\n", beta_);
 
   // allocate memory start
+  // y
+  clone(y_, y, num_ex_);
+
   // tau
   tau_ = new double*[num_ex_];
   *tau_ = new double[num_ex_ * num_classes_];
@@ -485,7 +510,13 @@ Spoc::Spoc(const Problem *prob, const MCSVMParameter *param, int *y, int num_cla
   // allocate memory end
 
   red_opt_ = new RedOpt(num_classes_, *param);
-  spoc_Q_ = new SPOC_Q(*prob, *param);
+  dense_ = NULL;
+  sparse_index_ = NULL;
+  if (!incremental) {
+    dense_ = Kernel::MakeDenseRows(num_ex_, prob->x, param->kernel_param);
+    sparse_index_ = (dense_ == NULL) ? Kernel::MakeSparseIndex(num_ex_, prob->x, param->kernel_param) : NULL;
+  }
+  spoc_Q_ = new SPOC_Q(*prob, *param, dense_, sparse_index_);
 
   num_support_pattern_ = 0;
   num_zero_pattern_ = 0;
@@ -520,22 +551,147 @@ Spoc::Spoc(const Problem *prob, const MCSVMParameter *param, int *y, int num_cla
   // tau
   for (int i = 0; i < num_ex_; ++i) {
     for (int j = 0 ; j < num_classes_; ++j) {
-      tau_[i][j] = 0;
+      tau_[i][j] = (init_tau != NULL) ? init_tau[i][j] : 0;
     }
   }
 
-  support_pattern_list_[0] = 0;
-  num_support_pattern_ = 1;
-
-  for (int i = 1; i < num_ex_; ++i) {
-    zero_pattern_list_[i-1] = i;
+  if (init_tau != NULL) {
+    // support patterns are the examples with non-zero tau, matrix_f gets their kernel columns
+    for (int i = 0; i < num_ex_; ++i) {
+      int j;
+      for (j = 0; j < num_classes_; ++j) {
+        if (tau_[i][j] != 0) {
+          break;
+        }
+      }
+      if (j < num_classes_) {
+        for (j = 0; j < num_classes_; ++j) {
+          delta_tau_[j] = tau_[i][j];
+        }
+        UpdateMatrix(spoc_Q_->get_Q(i, num_ex_));
+        support_pattern_list_[num_support_pattern_++] = i;
+      } else {
+        zero_pattern_list_[num_zero_pattern_++] = i;
+      }
+    }
   }
-  num_zero_pattern_ = num_ex_ - 1;
-  ChooseNextPattern(support_pattern_list_, num_support_pattern_);
+
+  InitPatterns();
 
   Info("Initializing ... done\n");
 }
 
+// the first pattern to optimize, from the support patterns and the zero patterns of tau
+void Spoc::InitPatterns() {
+  if (num_support_pattern_ == 0) {
+    support_pattern_list_[0] = 0;
+    num_support_pattern_ = 1;
+
+    num_zero_pattern_ = 0;
+    for (int i = 1; i < num_ex_; ++i) {
+      zero_pattern_list_[num_zero_pattern_++] = i;
+    }
+    ChooseNextPattern(support_pattern_list_, num_support_pattern_);
+  } else {
+    // the warm start may only violate the KKT conditions on zero patterns (e.g. the new examples)
+    ChooseNextPattern(zero_pattern_list_, num_zero_pattern_);
+    ChooseNextPattern(support_pattern_list_, num_support_pattern_);
+  }
+
+  return;
+}
+
+// rows*cols matrix (rows of cols doubles in one array) copied into a new_rows*new_cols one, the rest is zero
+static double **GrowMatrix(double **matrix, int rows, int cols, int new_rows, int new_cols) {
+  double **grown = new double*[new_rows];
+  *grown = new double[new_rows * new_cols];
+  for (int i = 1; i < new_rows; ++i) {
+    grown[i] = grown[i-1] + new_cols;
+  }
+  for (int i = 0; i < new_rows; ++i) {
+    for (int j = 0; j < new_cols; ++j) {
+      grown[i][j] = (i < rows && j < cols) ? matrix[i][j] : 0;
+    }
+  }
+  delete[] *matrix;
+  delete[] matrix;
+
+  return grown;
+}
+
+// appends the examples prob->x[num_ex_,prob->num_ex) (the first num_ex_ are the examples of this Spoc) with
+// their labels in y and zero tau, and the classes [num_classes_,num_classes), the next Solve starts from the
+// solution of the last one, matrix_f of the new examples comes from their own kernel columns, and the
+// cached columns are kept and filled up to the new examples when they are read again
+void Spoc::Grow(const Problem *prob, const int *y, int num_classes) {
+  int old_num_ex = num_ex_;
+  int old_num_classes = num_classes_;
+  num_ex_ = prob->num_ex;
+  num_classes_ = num_classes;
+
+  delete[] y_;
+  clone(y_, y, num_ex_);
+  tau_ = GrowMatrix(tau_, old_num_ex, old_num_classes, num_ex_, num_classes_);
+  matrix_f_ = GrowMatrix(matrix_f_, old_num_ex, old_num_classes, num_ex_, num_classes_);
+
+  if (num_classes_ > old_num_classes) {
+    delete[] *matrix_eye_;
+    delete[] matrix_eye_;
+    matrix_eye_ = new int*[num_classes_];
+    *matrix_eye_ = new int[num_classes_ * num_classes_];
+    for (int i = 1; i < num_classes_; ++i) {
+      matrix_eye_[i] = matrix_eye_[i-1] + num_classes_;
+    }
+    for (int i = 0; i < num_classes_; ++i) {
+      for (int j = 0; j < num_classes_; ++j) {
+        matrix_eye_[i][j] = (i == j) ? 1 : 0;
+      }
+    }
+    delete[] delta_tau_;
+    delete[] old_tau_;
+    delete[] vector_b_;
+    delta_tau_ = new double[num_classes_];
+    old_tau_ = new double[num_classes_];
+    vector_b_ = new double[num_classes_];
+    delete red_opt_;
+    red_opt_ = new RedOpt(num_classes_, param_);
+  }
+
+  int *support_pattern_list = new int[num_ex_];
+  int *zero_pattern_list = new int[num_ex_];
+  std::copy(support_pattern_list_, support_pattern_list_+num_support_pattern_, support_pattern_list);
+  std::copy(zero_pattern_list_, zero_pattern_list_+num_zero_pattern_, zero_pattern_list);
+  delete[] support_pattern_list_;
+  delete[] zero_pattern_list_;
+  support_pattern_list_ = support_pattern_list;
+  zero_pattern_list_ = zero_pattern_list;
+
+  spoc_Q_->Grow(num_ex_, prob->x);
+  vector_a_ = spoc_Q_->get_QD();
+
+  // matrix_f[i][j] = sum_p tau[p][j]*K(x_i,x_p) - beta*delta(y_i,j), only over the support patterns
+  for (int i = old_num_ex; i < num_ex_; ++i) {
+    matrix_f_[i][y_[i]] = -beta_;
+    if (num_support_pattern_ > 0) {
+      const Qfloat *kernel_i = spoc_Q_->get_Q(i, num_ex_);
+      for (int k = 0; k < num_support_pattern_; ++k) {
+        int p = support_pattern_list_[k];
+        for (int j = 0; j < num_classes_; ++j) {
+          matrix_f_[i][j] += tau_[p][j] * kernel_i[p];
+        }
+      }
+    }
+    zero_pattern_list_[num_zero_pattern_++] = i;
+  }
+
+  iteration_ = 12;
+  max_psi_ = 0;
+  next_p_list_ = 0;
+  InitPatterns();
+
+  return;
+}
+
 Spoc::~Spoc() {
   if (matrix_f_ != NULL) {
     if (*matrix_f_ != NULL) {
@@ -570,8 +726,11 @@ Spoc::~Spoc() {
     }
     delete[] tau_;
   }
+  delete[] y_;
   delete red_opt_;
   delete spoc_Q_;
+  FreeDenseRows(dense_);
+  FreeSparseIndex(sparse_index_);
 }
 
 Spoc::SolutionInfo *Spoc::Solve() {
@@ -631,7 +790,7 @@ void Spoc::CalcEpsilon(double epsilon) {
   int supp_only =1;
   int cont = 1;
   int mistake_k;
-  double *kernel_next_p;
+  const Qfloat *kernel_next_p;
 
   while (cont) {
     max_psi_ = 0;
@@ -731,9 +890,9 @@ void Spoc::ChooseNextPattern(int *pattern_list, int num_patterns) {
   return;
 }
 
-void Spoc::UpdateMatrix(double *kernel_next_p) {
+void Spoc::UpdateMatrix(const Qfloat *kernel_next_p) {
   double *delta_tau_ptr = delta_tau_;
-  double *kernel_next_p_ptr;
+  const Qfloat *kernel_next_p_ptr;
 
   for (int j = 0; j < num_classes_; ++j) {
     if (*delta_tau_ptr != 0) {
@@ -786,7 +945,63 @@ int Spoc::CountNumSVs() {
 
 // Spoc class end
 
+// the solver of the last call of TrainMCSVM, its training set and its parameter
+struct MCSVMWorkspace {
+  Spoc *spoc;
+  std::vector<Node*> x;
+  std::vector<double> y;
+  MCSVMParameter param;
+  KernelParameter kernel_param;
+};
+
+MCSVMWorkspace *MakeMCSVMWorkspace() {
+  MCSVMWorkspace *workspace = new MCSVMWorkspace;
+  workspace->spoc = NULL;
+
+  return workspace;
+}
+
+void FreeMCSVMWorkspace(MCSVMWorkspace *workspace) {
+  if (workspace->spoc != NULL) {
+    delete workspace->spoc;
+  }
+  delete workspace;
+
+  return;
+}
+
+// whether the solver kept in workspace can grow into the solver of prob and param,
+// which needs prob to start with the training set of the last call and the same param
+static bool CanGrow(const MCSVMWorkspace *workspace, const Problem *prob, const MCSVMParameter *param) {
+  const MCSVMParameter &kept = workspace->param;
+  const KernelParameter &kernel = workspace->kernel_param;
+  if (workspace->spoc == NULL || workspace->x.size() > static_cast<std::size_t>(prob->num_ex) ||
+      kept.redopt_type != param->redopt_type || kept.cache_size != param->cache_size || kept.beta != param->beta ||
+      kept.epsilon != param->epsilon || kept.epsilon0 != param->epsilon0 || kept.delta != param->delta ||
+      kernel.kernel_type != param->kernel_param->kernel_type || kernel.degree != param->kernel_param->degree ||
+      kernel.gamma != param->kernel_param->gamma || kernel.coef0 != param->kernel_param->coef0) {
+    return false;
+  }
+  for (std::size_t i = 0; i < workspace->x.size(); ++i) {
+    if (workspace->x[i] != prob->x[i] || workspace->y[i] != prob->y[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 MCSVMModel *TrainMCSVM(const struct Problem *prob, const struct MCSVMParameter *param) {
+  return TrainMCSVM(prob, param, NULL);
+}
+
+MCSVMModel *TrainMCSVM(const struct Problem *prob, const struct MCSVMParameter *param, const struct MCSVMModel *init_model) {
+  return TrainMCSVM(prob, param, init_model, NULL);
+}
+
+// with a workspace, the solver is kept in it and grows with the training set of the next call
+// instead of being warm started from init_model
+MCSVMModel *TrainMCSVM(const struct Problem *prob, const struct MCSVMParameter *param, const struct MCSVMModel *init_model, struct MCSVMWorkspace *workspace) {
   MCSVMModel *model = new MCSVMModel;
   model->param = *param;
 
@@ -824,8 +1039,62 @@ MCSVMModel *TrainMCSVM(const struct Problem *prob, const struct MCSVMParameter *
   // train MSCVM model
   Info("\nCrammer and Singer's Multi-Class SVM Train\n");
   Info("%d examples,  %d classes\n", num_ex, num_classes);
-  Spoc s(prob, param, alter_labels, num_classes);
-  Spoc::SolutionInfo *si = s.Solve();
+  // warm start from the tau of init_model, which was trained on a prefix of prob
+  double **init_tau = NULL;
+  if (init_model != NULL && workspace == NULL) {
+    init_tau = new double*[num_ex];
+    *init_tau = new double[num_ex * num_classes];
+    for (int i = 1; i < num_ex; ++i) {
+      init_tau[i] = init_tau[i-1] + num_classes;
+    }
+    for (int i = 0; i < num_ex * num_classes; ++i) {
+      (*init_tau)[i] = 0;
+    }
+    for (int i = 0; i < init_model->num_classes; ++i) {
+      int j;
+      for (j = 0; j < num_classes; ++j) {
+        if (labels[j] == init_model->labels[i]) {
+          break;
+        }
+      }
+      if (j == num_classes) {
+        continue;
+      }
+      for (int k = 0; k < init_model->total_sv; ++k) {
+        int index = init_model->sv_indices[k] - 1;
+        if (index >= 0 && index < num_ex) {
+          init_tau[index][j] = init_model->tau[i][k];
+        }
+      }
+    }
+  }
+
+  Spoc *spoc;
+  if (workspace == NULL) {
+    spoc = new Spoc(prob, param, alter_labels, num_classes, init_tau, false);
+  } else if (CanGrow(workspace, prob, param)) {
+    spoc = workspace->spoc;
+    spoc->Grow(prob, alter_labels, num_classes);
+  } else {
+    if (workspace->spoc != NULL) {
+      delete workspace->spoc;
+    }
+    spoc = workspace->spoc = new Spoc(prob, param, alter_labels, num_classes, NULL, true);
+    workspace->param = *param;
+    workspace->kernel_param = *param->kernel_param;
+  }
+  Spoc::SolutionInfo *si = spoc->Solve();
+  if (workspace == NULL) {
+    delete spoc;
+  } else {
+    workspace->x.assign(prob->x, prob->x+num_ex);
+    workspace->y.assign(prob->y, prob->y+num_ex);
+  }
+
+  if (init_tau != NULL) {
+    delete[] *init_tau;
+    delete[] init_tau;
+  }
 
   // build output
   model->total_sv = si->total_sv;
@@ -840,6 +1109,7 @@ MCSVMModel *TrainMCSVM(const struct Problem *prob, const struct MCSVMParameter *
   model->num_ex = num_ex;
   model->num_classes = num_classes;
   model->labels = labels;
+  model->sv_kernel = new SVKernel(model->total_sv, model->svs, model->param.kernel_param);
 
   delete[] alter_labels;
 
@@ -853,9 +1123,7 @@ double *PredictMCSVMValues(const struct MCSVMModel *model, const struct Node *x)
   double *sim_scores = new double[num_classes];
   double *kernel_values = new double[total_sv];
 
-  for (int i = 0; i < total_sv; ++i) {
-    kernel_values[i] = Kernel::KernelFunction(x, model->svs[i], model->param.kernel_param);
-  }
+  model->sv_kernel->KernelValues(x, kernel_values);
 
   for (int i = 0; i < num_classes; ++i) {
     sim_scores[i] = 0;
@@ -997,6 +1265,7 @@ MCSVMModel *LoadMCSVMModel(std::ifstream &model_file) {
   model->num_svs = NULL;
   model->svs = NULL;
   model->tau = NULL;
+  model->sv_kernel = NULL;
 
   char cmd[80];
   while (1) {
@@ -1149,6 +1418,7 @@ MCSVMModel *LoadMCSVMModel(std::ifstream &model_file) {
       return NULL;
     }
   }
+  model->sv_kernel = new SVKernel(model->total_sv, model->svs, model->param.kernel_param);
 
   return model;
 }
@@ -1159,6 +1429,11 @@ void FreeMCSVMModel(struct MCSVMModel *model) {
     model->svs = NULL;
   }
 
+  if (model->sv_kernel != NULL) {
+    delete model->sv_kernel;
+    model->sv_kernel = NULL;
+  }
+
   if (model->tau != NULL) {
     for (int i = 0; i < model->num_classes; ++i) {
       if (model->tau[i] != NULL) {
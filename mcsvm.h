@@ -26,9 +26,14 @@ struct MCSVMModel {
   int *sv_indices;
   double **tau;
   struct Node **svs;
+  SVKernel *sv_kernel;  // kernel values with the SVs for prediction
 };
 
+struct MCSVMWorkspace;  // the solver of TrainMCSVM, kept to grow with the training set of a later call
+
 MCSVMModel *TrainMCSVM(const struct Problem *prob, const struct MCSVMParameter *param);
+MCSVMModel *TrainMCSVM(const struct Problem *prob, const struct MCSVMParameter *param, const struct MCSVMModel *init_model);
+MCSVMModel *TrainMCSVM(const struct Problem *prob, const struct MCSVMParameter *param, const struct MCSVMModel *init_model, struct MCSVMWorkspace *workspace);
 double *PredictMCSVMValues(const struct MCSVMModel *model, const struct Node *x);
 int PredictMCSVM(const struct MCSVMModel *model, const struct Node *x, int *num_max_sim_score_ret);
 double PredictMCSVMMaxValue(const struct MCSVMModel *model, const struct Node *x);
@@ -37,6 +42,9 @@ int SaveMCSVMModel(std::ofstream &model_file, const struct MCSVMModel *model);
 MCSVMModel *LoadMCSVMModel(std::ifstream &model_file);
 void FreeMCSVMModel(struct MCSVMModel *model);
 
+MCSVMWorkspace *MakeMCSVMWorkspace();
+void FreeMCSVMWorkspace(struct MCSVMWorkspace *workspace);
+
 void FreeMCSVMParam(struct MCSVMParameter *param);
 void InitMCSVMParam(struct MCSVMParameter *param);
 const char *CheckMCSVMParameter(const struct MCSVMParameter *param);
@@ -5,10 +5,129 @@
 #include <iomanip>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <exception>
+#include <cstring>
+#include <random>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LIBVM_X86_SIMD
+#endif
+
+// the gradient updates of the solvers are cloned for AVX-512, AVX2 and the baseline instruction set and
+// picked at runtime, without fused multiply-adds, so that all the clones give the same results
+#if defined(LIBVM_X86_SIMD) && defined(__linux__) && !defined(__clang__)
+#define LIBVM_SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default"), optimize("fp-contract=off")))
+#else
+#define LIBVM_SIMD_CLONES
+#endif
 
 typedef signed char schar;
 
+static inline bool IsLinearSVC(int svm_type) {
+  return svm_type == L1_LINEAR_SVC || svm_type == L2_LINEAR_SVC;
+}
+
+// G[k] += Q_i[k]*delta_i + Q_j[k]*delta_j for k in [0,len)
+LIBVM_SIMD_CLONES
+static void UpdateGradient(double *G, const Qfloat *Q_i, const Qfloat *Q_j, double delta_i, double delta_j, int len) {
+  for (int k = 0; k < len; ++k) {
+    G[k] += Q_i[k]*delta_i + Q_j[k]*delta_j;
+  }
+}
+
+// G[k] += C * Q_i[k] for k in [0,len)
+LIBVM_SIMD_CLONES
+static void AddScaledColumn(double *G, const Qfloat *Q_i, double C, int len) {
+  for (int k = 0; k < len; ++k) {
+    G[k] += C * Q_i[k];
+  }
+}
+
+#ifdef LIBVM_X86_SIMD
+static bool HasAVX2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+
+__attribute__((target("avx2")))
+static inline __m256d LoadQ4(const double *p) {
+  return _mm256_loadu_pd(p);
+}
+
+__attribute__((target("avx2")))
+static inline __m256d LoadQ4(const float *p) {
+  return _mm256_cvtps_pd(_mm_loadu_ps(p));
+}
+
+// 4 bytes of y or alpha_status sign extended into the 64-bit lanes
+__attribute__((target("avx2")))
+static inline __m256i LoadBytes4(const char *p) {
+  int bytes;
+  std::memcpy(&bytes, p, sizeof(bytes));
+  return _mm256_cvtepi8_epi64(_mm_cvtsi32_si128(bytes));
+}
+#endif
+
+//
+// Workspace of the solvers
+//
+// an array that is only reallocated when it has to grow
+template <typename T>
+class Buffer {
+ public:
+  Buffer() : data_(NULL), size_(0) {}
+  ~Buffer() {
+    delete[] data_;
+  }
+  T *get(int size) {
+    if (size > size_) {
+      delete[] data_;
+      data_ = new T[size];
+      size_ = size;
+    }
+    return data_;
+  }
+
+ private:
+  T *data_;
+  int size_;
+  Buffer(const Buffer &);
+  Buffer &operator=(const Buffer &);
+};
+
+// the arrays of the binary subproblems trained on one thread, at most one of them at a time
+struct SolverBuffers {
+  // TrainSVM
+  Buffer<Node*> sub_x;
+  Buffer<double> sub_y;
+  Buffer<int> sub_index;
+  Buffer<double> init_alpha;
+  // SolveCSVC, SolveNuSVC and SolveLinearSVC
+  Buffer<schar> y;
+  Buffer<double> p;  // minus_ones or zeros
+  Buffer<double> QD;
+  Buffer<int> index;
+  Buffer<double> w;
+  // Solver
+  Buffer<double> solver_p;
+  Buffer<schar> solver_y;
+  Buffer<double> solver_alpha;
+  Buffer<char> alpha_status;
+  Buffer<int> active_set;
+  Buffer<double> G;
+  Buffer<double> G_bar;
+  // SVC_Q
+  Buffer<schar> Q_y;
+  Buffer<double> Q_QD;
+  Buffer<int> Q_index;
+  Buffer<int> Q_block;
+  Buffer<int> Q_offset;
+  Buffer<const Qfloat*> Q_data;
+  Buffer<Qfloat> Q_buffer[2];
+};
+
 // An SMO algorithm in Fan et al., JMLR 6(2005), p. 1889--1918
 // Solves:
 //
@@ -24,8 +143,10 @@ typedef signed char schar;
 //  Q, p, y, Cp, Cn, and an initial feasible point \alpha
 //  l is the size of vectors and matrices
 //  eps is the stopping tolerance
+//  G and G_bar (NULL to compute them) are the gradient of the initial \alpha and its part of the upper bounds
 //
-// solution will be put in \alpha, objective value will be put in obj
+// solution will be put in \alpha, objective value will be put in obj,
+// and the gradient of the solution in G and G_bar if they are not NULL
 //
 class Solver {
  public:
@@ -42,7 +163,7 @@ class Solver {
 
   void Solve(int l, const QMatrix &Q, const double *p, const schar *y,
       double *alpha, double Cp, double Cn, double eps,
-      SolutionInfo *si, int shrinking);
+      SolutionInfo *si, int shrinking, SolverBuffers *buffers, double *G, double *G_bar);
 
  protected:
   int active_size_;
@@ -61,6 +182,7 @@ class Solver {
   double *G_bar_;  // gradient, if we treat free variables as 0
   int l_;
   bool unshrink_;  // XXX
+  WorkerPool *pool_;  // splits the loops over the examples, NULL to run them on the calling thread
 
   double get_C(int i) {
     return (y_[i] > 0) ? Cp_ : Cn_;
@@ -76,15 +198,35 @@ class Solver {
       }
     }
   }
-  bool IsUpperBound(int i) {
+  bool IsUpperBound(int i) const {
     return alpha_status_[i] == UPPER_BOUND;
   }
-  bool IsLowerBound(int i) {
+  bool IsLowerBound(int i) const {
     return alpha_status_[i] == LOWER_BOUND;
   }
-  bool IsFree(int i) {
+  bool IsFree(int i) const {
     return alpha_status_[i] == FREE;
   }
+
+  // the scans of the working set selection over the active set, class c is 0 for y = +1 and 1 for y = -1
+  struct UpScan {
+    double Gmax[2];  // maximum of -y_t*G_t over I_up of class c
+    int Gmax_idx[2];  // the last t attaining it, -1 if there is none
+  };
+  struct LowScan {
+    // grad_diff = Gmax[c]+y_j*G_j, quad_coef = QD[c]+QD_j-coef[c]*Q[c][j]
+    double Gmax[2];
+    const Qfloat *Q[2];
+    double QD[2];
+    double coef[2];
+    double Gmax2[2];  // maximum of y_j*G_j over I_low of class c
+    double obj_diff_min;
+    int Gmin_idx;  // the last j attaining obj_diff_min among grad_diff > 0, -1 if there is none
+  };
+  void ScanUp(UpScan *scan);
+  void ScanLow(LowScan *scan);
+  void AddColumn(double *G, const Qfloat *Q_i, double C, int len);
+  void AddColumns(double *G, const Qfloat *Q_i, const Qfloat *Q_j, double C_i, double C_j, int len);
   void SwapIndex(int i, int j);
   void ReconstructGradient();
   virtual int SelectWorkingSet(int &i, int &j);
@@ -92,7 +234,15 @@ class Solver {
   virtual void DoShrinking();
 
  private:
+  std::vector<UpScan> up_parts_;  // the scans of the parts of the active set
+  std::vector<LowScan> low_parts_;
   bool IsShrunk(int i, double Gmax1, double Gmax2);
+  void ScanUpRange(int start, int end, UpScan *scan) const;
+  void ScanLowRange(int start, int end, LowScan *scan) const;
+#ifdef LIBVM_X86_SIMD
+  static int ScanUpAVX2(int start, int end, const schar *y, const char *alpha_status, const double *G, UpScan *scan);
+  static int ScanLowAVX2(int start, int end, const schar *y, const char *alpha_status, const double *G, const double *QD, LowScan *scan);
+#endif
 };
 
 void Solver::SwapIndex(int i, int j) {
@@ -106,6 +256,266 @@ void Solver::SwapIndex(int i, int j) {
   std::swap(G_bar_[i], G_bar_[j]);
 }
 
+// the active set is scanned in consecutive parts, one on each thread of pool_, and the results of the parts
+// are merged in order with the ties broken towards the later part, so the working set is the same as in
+// a single loop
+void Solver::ScanUp(UpScan *scan) {
+  int num_parts = ParallelRange(pool_, active_size_, [this](int part, int start, int end) {
+    ScanUpRange(start, end, &up_parts_[static_cast<std::size_t>(part)]);
+  });
+  *scan = up_parts_[0];
+  for (int p = 1; p < num_parts; ++p) {
+    const UpScan &part = up_parts_[static_cast<std::size_t>(p)];
+    for (int c = 0; c < 2; ++c) {
+      if (part.Gmax_idx[c] != -1 && part.Gmax[c] >= scan->Gmax[c]) {
+        scan->Gmax[c] = part.Gmax[c];
+        scan->Gmax_idx[c] = part.Gmax_idx[c];
+      }
+    }
+  }
+}
+
+void Solver::ScanLow(LowScan *scan) {
+  int num_parts = ParallelRange(pool_, active_size_, [this, scan](int part, int start, int end) {
+    low_parts_[static_cast<std::size_t>(part)] = *scan;
+    ScanLowRange(start, end, &low_parts_[static_cast<std::size_t>(part)]);
+  });
+  *scan = low_parts_[0];
+  for (int p = 1; p < num_parts; ++p) {
+    const LowScan &part = low_parts_[static_cast<std::size_t>(p)];
+    scan->Gmax2[0] = std::max(scan->Gmax2[0], part.Gmax2[0]);
+    scan->Gmax2[1] = std::max(scan->Gmax2[1], part.Gmax2[1]);
+    if (part.Gmin_idx != -1 && part.obj_diff_min <= scan->obj_diff_min) {
+      scan->obj_diff_min = part.obj_diff_min;
+      scan->Gmin_idx = part.Gmin_idx;
+    }
+  }
+}
+
+// the AVX2 scans cover a multiple of 4 examples, whose maxima and minima are reduced over the lanes with the
+// ties broken towards the last index, and the rest is scanned by the scalar loops, so the working set is the
+// same as in a single scalar loop
+void Solver::ScanUpRange(int start, int end, UpScan *scan) const {
+  scan->Gmax[0] = scan->Gmax[1] = -kInf;
+  scan->Gmax_idx[0] = scan->Gmax_idx[1] = -1;
+
+  int t = start;
+#ifdef LIBVM_X86_SIMD
+  if (HasAVX2()) {
+    t = ScanUpAVX2(start, end, y_, alpha_status_, G_, scan);
+  }
+#endif
+  double Gmaxp = scan->Gmax[0];
+  double Gmaxn = scan->Gmax[1];
+  int Gmaxp_idx = scan->Gmax_idx[0];
+  int Gmaxn_idx = scan->Gmax_idx[1];
+  for ( ; t < end; ++t) {
+    if (y_[t] == +1) {
+      if (!IsUpperBound(t) && -G_[t] >= Gmaxp) {
+        Gmaxp = -G_[t];
+        Gmaxp_idx = t;
+      }
+    } else {
+      if (!IsLowerBound(t) && G_[t] >= Gmaxn) {
+        Gmaxn = G_[t];
+        Gmaxn_idx = t;
+      }
+    }
+  }
+  scan->Gmax[0] = Gmaxp;
+  scan->Gmax[1] = Gmaxn;
+  scan->Gmax_idx[0] = Gmaxp_idx;
+  scan->Gmax_idx[1] = Gmaxn_idx;
+}
+
+void Solver::ScanLowRange(int start, int end, LowScan *scan) const {
+  scan->Gmax2[0] = scan->Gmax2[1] = -kInf;
+  scan->obj_diff_min = kInf;
+  scan->Gmin_idx = -1;
+
+  int j = start;
+#ifdef LIBVM_X86_SIMD
+  if (HasAVX2()) {
+    j = ScanLowAVX2(start, end, y_, alpha_status_, G_, QD_, scan);
+  }
+#endif
+  double Gmax2[2] = { scan->Gmax2[0], scan->Gmax2[1] };
+  double obj_diff_min = scan->obj_diff_min;
+  int Gmin_idx = scan->Gmin_idx;
+  for ( ; j < end; ++j) {
+    int c;
+    double v;
+    if (y_[j] == +1) {
+      if (IsLowerBound(j)) {
+        continue;
+      }
+      c = 0;
+      v = G_[j];
+    } else {
+      if (IsUpperBound(j)) {
+        continue;
+      }
+      c = 1;
+      v = -G_[j];
+    }
+    if (v >= Gmax2[c]) {
+      Gmax2[c] = v;
+    }
+    double grad_diff = scan->Gmax[c] + v;
+    if (grad_diff > 0) {
+      double obj_diff;
+      double quad_coef = scan->QD[c] + QD_[j] - scan->coef[c]*scan->Q[c][j];
+      if (quad_coef > 0) {
+        obj_diff = -(grad_diff*grad_diff) / quad_coef;
+      } else {
+        obj_diff = -(grad_diff*grad_diff) / kTau;
+      }
+      if (obj_diff <= obj_diff_min) {
+        Gmin_idx = j;
+        obj_diff_min = obj_diff;
+      }
+    }
+  }
+  scan->Gmax2[0] = Gmax2[0];
+  scan->Gmax2[1] = Gmax2[1];
+  scan->obj_diff_min = obj_diff_min;
+  scan->Gmin_idx = Gmin_idx;
+}
+
+#ifdef LIBVM_X86_SIMD
+__attribute__((target("avx2")))
+int Solver::ScanUpAVX2(int start, int end, const schar *y, const char *alpha_status, const double *G, UpScan *scan) {
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256i ones = _mm256_set1_epi64x(-1);
+  const __m256i upper = _mm256_set1_epi64x(UPPER_BOUND);
+  const __m256i lower = _mm256_set1_epi64x(LOWER_BOUND);
+  __m256d Gmax_p = _mm256_set1_pd(-kInf);
+  __m256d Gmax_n = _mm256_set1_pd(-kInf);
+  __m256i idx_p = ones;
+  __m256i idx_n = ones;
+  __m256i idx = _mm256_setr_epi64x(start, start+1, start+2, start+3);
+  const __m256i four = _mm256_set1_epi64x(4);
+
+  int t;
+  for (t = start; t+4 <= end; t += 4) {
+    __m256i pos = _mm256_cmpgt_epi64(LoadBytes4(reinterpret_cast<const char *>(y)+t), _mm256_setzero_si256());
+    __m256i status = LoadBytes4(alpha_status+t);
+    // I_up: y = +1 and not at the upper bound, or y = -1 and not at the lower bound
+    __m256i out = _mm256_blendv_epi8(_mm256_cmpeq_epi64(status, lower), _mm256_cmpeq_epi64(status, upper), pos);
+    __m256d in_p = _mm256_castsi256_pd(_mm256_andnot_si256(out, pos));
+    __m256d in_n = _mm256_castsi256_pd(_mm256_andnot_si256(_mm256_or_si256(out, pos), ones));
+    __m256d v = _mm256_xor_pd(_mm256_loadu_pd(G+t), _mm256_and_pd(_mm256_castsi256_pd(pos), sign));
+
+    __m256d take_p = _mm256_and_pd(in_p, _mm256_cmp_pd(v, Gmax_p, _CMP_GE_OQ));
+    Gmax_p = _mm256_blendv_pd(Gmax_p, v, take_p);
+    idx_p = _mm256_blendv_epi8(idx_p, idx, _mm256_castpd_si256(take_p));
+    __m256d take_n = _mm256_and_pd(in_n, _mm256_cmp_pd(v, Gmax_n, _CMP_GE_OQ));
+    Gmax_n = _mm256_blendv_pd(Gmax_n, v, take_n);
+    idx_n = _mm256_blendv_epi8(idx_n, idx, _mm256_castpd_si256(take_n));
+    idx = _mm256_add_epi64(idx, four);
+  }
+
+  double lane_Gmax[2][4];
+  long long lane_idx[2][4];
+  _mm256_storeu_pd(lane_Gmax[0], Gmax_p);
+  _mm256_storeu_pd(lane_Gmax[1], Gmax_n);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_idx[0]), idx_p);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_idx[1]), idx_n);
+  for (int c = 0; c < 2; ++c) {
+    for (int k = 0; k < 4; ++k) {
+      if (lane_idx[c][k] != -1 &&
+          (lane_Gmax[c][k] > scan->Gmax[c] || (lane_Gmax[c][k] == scan->Gmax[c] && lane_idx[c][k] > scan->Gmax_idx[c]))) {
+        scan->Gmax[c] = lane_Gmax[c][k];
+        scan->Gmax_idx[c] = static_cast<int>(lane_idx[c][k]);
+      }
+    }
+  }
+
+  return t;
+}
+
+__attribute__((target("avx2")))
+int Solver::ScanLowAVX2(int start, int end, const schar *y, const char *alpha_status, const double *G, const double *QD, LowScan *scan) {
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d tau = _mm256_set1_pd(kTau);
+  const __m256i upper = _mm256_set1_epi64x(UPPER_BOUND);
+  const __m256i lower = _mm256_set1_epi64x(LOWER_BOUND);
+  const __m256d Gmax_p = _mm256_set1_pd(scan->Gmax[0]);
+  const __m256d Gmax_n = _mm256_set1_pd(scan->Gmax[1]);
+  const __m256d QD_p = _mm256_set1_pd(scan->QD[0]);
+  const __m256d QD_n = _mm256_set1_pd(scan->QD[1]);
+  const __m256d coef_p = _mm256_set1_pd(scan->coef[0]);
+  const __m256d coef_n = _mm256_set1_pd(scan->coef[1]);
+  __m256d Gmax2_p = _mm256_set1_pd(-kInf);
+  __m256d Gmax2_n = _mm256_set1_pd(-kInf);
+  __m256d obj_diff_min = _mm256_set1_pd(kInf);
+  __m256i Gmin_idx = _mm256_set1_epi64x(-1);
+  __m256i idx = _mm256_setr_epi64x(start, start+1, start+2, start+3);
+  const __m256i four = _mm256_set1_epi64x(4);
+
+  int j;
+  for (j = start; j+4 <= end; j += 4) {
+    __m256i pos = _mm256_cmpgt_epi64(LoadBytes4(reinterpret_cast<const char *>(y)+j), _mm256_setzero_si256());
+    __m256d pos_pd = _mm256_castsi256_pd(pos);
+    __m256i status = LoadBytes4(alpha_status+j);
+    // I_low: y = +1 and not at the lower bound, or y = -1 and not at the upper bound
+    __m256i out = _mm256_blendv_epi8(_mm256_cmpeq_epi64(status, upper), _mm256_cmpeq_epi64(status, lower), pos);
+    __m256d in = _mm256_castsi256_pd(_mm256_xor_si256(out, _mm256_set1_epi64x(-1)));
+    __m256d v = _mm256_xor_pd(_mm256_loadu_pd(G+j), _mm256_andnot_pd(pos_pd, sign));
+
+    Gmax2_p = _mm256_blendv_pd(Gmax2_p, _mm256_max_pd(Gmax2_p, v), _mm256_and_pd(in, pos_pd));
+    Gmax2_n = _mm256_blendv_pd(Gmax2_n, _mm256_max_pd(Gmax2_n, v), _mm256_andnot_pd(pos_pd, in));
+
+    __m256d grad_diff = _mm256_add_pd(_mm256_blendv_pd(Gmax_n, Gmax_p, pos_pd), v);
+    __m256d Q_j = _mm256_blendv_pd(LoadQ4(scan->Q[1]+j), LoadQ4(scan->Q[0]+j), pos_pd);
+    __m256d quad_coef = _mm256_sub_pd(_mm256_add_pd(_mm256_blendv_pd(QD_n, QD_p, pos_pd), _mm256_loadu_pd(QD+j)),
+                                      _mm256_mul_pd(_mm256_blendv_pd(coef_n, coef_p, pos_pd), Q_j));
+    quad_coef = _mm256_blendv_pd(tau, quad_coef, _mm256_cmp_pd(quad_coef, zero, _CMP_GT_OQ));
+    __m256d obj_diff = _mm256_div_pd(_mm256_xor_pd(_mm256_mul_pd(grad_diff, grad_diff), sign), quad_coef);
+
+    __m256d take = _mm256_and_pd(_mm256_and_pd(in, _mm256_cmp_pd(grad_diff, zero, _CMP_GT_OQ)),
+                                 _mm256_cmp_pd(obj_diff, obj_diff_min, _CMP_LE_OQ));
+    obj_diff_min = _mm256_blendv_pd(obj_diff_min, obj_diff, take);
+    Gmin_idx = _mm256_blendv_epi8(Gmin_idx, idx, _mm256_castpd_si256(take));
+    idx = _mm256_add_epi64(idx, four);
+  }
+
+  double lane_Gmax2[2][4];
+  double lane_obj_diff[4];
+  long long lane_idx[4];
+  _mm256_storeu_pd(lane_Gmax2[0], Gmax2_p);
+  _mm256_storeu_pd(lane_Gmax2[1], Gmax2_n);
+  _mm256_storeu_pd(lane_obj_diff, obj_diff_min);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_idx), Gmin_idx);
+  for (int k = 0; k < 4; ++k) {
+    scan->Gmax2[0] = std::max(scan->Gmax2[0], lane_Gmax2[0][k]);
+    scan->Gmax2[1] = std::max(scan->Gmax2[1], lane_Gmax2[1][k]);
+    if (lane_idx[k] != -1 &&
+        (lane_obj_diff[k] < scan->obj_diff_min || (lane_obj_diff[k] == scan->obj_diff_min && lane_idx[k] > scan->Gmin_idx))) {
+      scan->obj_diff_min = lane_obj_diff[k];
+      scan->Gmin_idx = static_cast<int>(lane_idx[k]);
+    }
+  }
+
+  return j;
+}
+#endif
+
+// G[k] += C * Q_i[k] for k in [0,len), each part of [0,len) on a thread of pool_
+void Solver::AddColumn(double *G, const Qfloat *Q_i, double C, int len) {
+  ParallelRange(pool_, len, [G, Q_i, C](int, int start, int end) {
+    AddScaledColumn(G+start, Q_i+start, C, end-start);
+  });
+}
+
+// G[k] += Q_i[k]*C_i + Q_j[k]*C_j for k in [0,len), each part of [0,len) on a thread of pool_
+void Solver::AddColumns(double *G, const Qfloat *Q_i, const Qfloat *Q_j, double C_i, double C_j, int len) {
+  ParallelRange(pool_, len, [G, Q_i, Q_j, C_i, C_j](int, int start, int end) {
+    UpdateGradient(G+start, Q_i+start, Q_j+start, C_i, C_j, end-start);
+  });
+}
+
 void Solver::ReconstructGradient() {
   // reconstruct inactive elements of G from G_bar_ and free variables
   if (active_size_ == l_) {
@@ -141,62 +551,67 @@ void Solver::ReconstructGradient() {
     for (int i = 0; i < active_size_; ++i) {
       if (IsFree(i)) {
         const Qfloat *Q_i = Q_->get_Q(i, l_);
-        double alpha_i = alpha_[i];
-        for (int j = active_size_; j < l_; ++j) {
-          G_[j] += alpha_i * Q_i[j];
-        }
+        AddColumn(G_+active_size_, Q_i+active_size_, alpha_[i], l_-active_size_);
       }
     }
   }
 }
 
+// the arrays of the solver are taken from buffers, which keeps them for the next subproblem
 void Solver::Solve(int l, const QMatrix &Q, const double *p, const schar *y,
     double *alpha, double Cp, double Cn, double eps,
-    SolutionInfo *si, int shrinking) {
+    SolutionInfo *si, int shrinking, SolverBuffers *buffers, double *G, double *G_bar) {
   l_ = l;
   Q_ = &Q;
   QD_=Q.get_QD();
-  clone(p_, p, l);
-  clone(y_, y, l);
-  clone(alpha_, alpha, l);
+  pool_ = Q.get_pool();
+  std::size_t num_parts = static_cast<std::size_t>((pool_ != NULL) ? pool_->get_num_threads() : 1);
+  up_parts_.resize(num_parts);
+  low_parts_.resize(num_parts);
+  p_ = buffers->solver_p.get(l);
+  y_ = buffers->solver_y.get(l);
+  alpha_ = buffers->solver_alpha.get(l);
+  std::copy(p, p+l, p_);
+  std::copy(y, y+l, y_);
+  std::copy(alpha, alpha+l, alpha_);
   Cp_ = Cp;
   Cn_ = Cn;
   eps_ = eps;
   unshrink_ = false;
 
   // initialize alpha_status_
-  alpha_status_ = new char[l];
+  alpha_status_ = buffers->alpha_status.get(l);
   for (int i = 0; i < l; ++i) {
     UpdateAlphaStatus(i);
   }
 
   // initialize active set (for shrinking)
-  active_set_ = new int[l];
+  active_set_ = buffers->active_set.get(l);
   for (int i = 0; i < l; ++i) {
     active_set_[i] = i;
   }
   active_size_ = l;
 
   // initialize gradient
-  G_ = new double[l];
-  G_bar_ = new double[l];
-  for (int i = 0; i < l; ++i) {
-    G_[i] = p_[i];
-    G_bar_[i] = 0;
-  }
-  for (int i = 0; i < l; ++i)
-    if (!IsLowerBound(i)) {
-      const Qfloat *Q_i = Q.get_Q(i,l);
-      double alpha_i = alpha_[i];
-      for (int j = 0; j < l; ++j) {
-        G_[j] += alpha_i*Q_i[j];
-      }
-      if (IsUpperBound(i)) {
-        for (int j = 0; j < l; ++j) {
-          G_bar_[j] += get_C(i) * Q_i[j];
+  G_ = buffers->G.get(l);
+  G_bar_ = buffers->G_bar.get(l);
+  if (G != NULL) {
+    std::copy(G, G+l, G_);
+    std::copy(G_bar, G_bar+l, G_bar_);
+  } else {
+    for (int i = 0; i < l; ++i) {
+      G_[i] = p_[i];
+      G_bar_[i] = 0;
+    }
+    for (int i = 0; i < l; ++i)
+      if (!IsLowerBound(i)) {
+        const Qfloat *Q_i = Q.get_Q(i,l);
+        AddColumn(G_, Q_i, alpha_[i], l);
+        if (IsUpperBound(i)) {
+          AddColumn(G_bar_, Q_i, get_C(i), l);
         }
       }
-    }
+  }
 
   // optimization step
   int iter = 0;
@@ -309,9 +724,7 @@ void Solver::Solve(int l, const QMatrix &Q, const double *p, const schar *y,
     double delta_alpha_i = alpha_[i] - old_alpha_i;
     double delta_alpha_j = alpha_[j] - old_alpha_j;
 
-    for (int k = 0; k < active_size_; ++k) {
-      G_[k] += Q_i[k]*delta_alpha_i + Q_j[k]*delta_alpha_j;
-    }
+    AddColumns(G_, Q_i, Q_j, delta_alpha_i, delta_alpha_j, active_size_);
 
     // update alpha_status_ and G_bar_
     bool ui = IsUpperBound(i);
@@ -320,28 +733,12 @@ void Solver::Solve(int l, const QMatrix &Q, const double *p, const schar *y,
     UpdateAlphaStatus(j);
     if (ui != IsUpperBound(i)) {
       Q_i = Q.get_Q(i, l);
-      if (ui) {
-        for (int k = 0; k < l; ++k) {
-          G_bar_[k] -= C_i * Q_i[k];
-        }
-      } else {
-        for (int k = 0; k < l; ++k) {
-          G_bar_[k] += C_i * Q_i[k];
-        }
-      }
+      AddColumn(G_bar_, Q_i, ui ? -C_i : C_i, l);
     }
 
     if (uj != IsUpperBound(j)) {
       Q_j = Q.get_Q(j, l);
-      if (uj) {
-        for (int k = 0; k < l; ++k) {
-          G_bar_[k] -= C_j * Q_j[k];
-        }
-      } else {
-        for (int k = 0; k < l; ++k) {
-          G_bar_[k] += C_j * Q_j[k];
-        }
-      }
+      AddColumn(G_bar_, Q_j, uj ? -C_j : C_j, l);
     }
   }
 
@@ -365,10 +762,16 @@ void Solver::Solve(int l, const QMatrix &Q, const double *p, const schar *y,
   }
   si->obj = v / 2;
 
-  // put back the solution
+  // put back the solution (the whole gradient is up to date, since the active set is all of it at the end)
   for (int i = 0; i < l; ++i) {
     alpha[active_set_[i]] = alpha_[i];
   }
+  if (G != NULL) {
+    for (int i = 0; i < l; ++i) {
+      G[active_set_[i]] = G_[i];
+      G_bar[active_set_[i]] = G_bar_[i];
+    }
+  }
 
   // juggle everything back
   /*{
@@ -382,14 +785,6 @@ void Solver::Solve(int l, const QMatrix &Q, const double *p, const schar *y,
   si->upper_bound_n = Cn;
 
   Info("\noptimization finished, #iter = %d\n", iter);
-
-  delete[] p_;
-  delete[] y_;
-  delete[] alpha_;
-  delete[] alpha_status_;
-  delete[] active_set_;
-  delete[] G_;
-  delete[] G_bar_;
 }
 
 // return 1 if already optimal, return 0 otherwise
@@ -400,79 +795,25 @@ int Solver::SelectWorkingSet(int &out_i, int &out_j) {
   //    (if quadratic coefficeint <= 0, replace it with tau)
   //    -y_j*grad(f)_j < -y_i*grad(f)_i, j in I_low(\alpha)
 
-  double Gmax = -kInf;
-  double Gmax2 = -kInf;
-  int Gmax_idx = -1;
-  int Gmin_idx = -1;
-  double obj_diff_min = kInf;
-
-  for (int t = 0; t < active_size_; ++t)
-    if (y_[t] == +1) {
-      if (!IsUpperBound(t)) {
-        if (-G_[t] >= Gmax) {
-          Gmax = -G_[t];
-          Gmax_idx = t;
-        }
-      }
-    } else {
-      if (!IsLowerBound(t)) {
-        if (G_[t] >= Gmax) {
-          Gmax = G_[t];
-          Gmax_idx = t;
-        }
-      }
-    }
-
-  int i = Gmax_idx;
-  const Qfloat *Q_i = NULL;
-  if (i != -1) {// NULL Q_i not accessed: Gmax=-kInf if i=-1
-    Q_i = Q_->get_Q(i, active_size_);
+  UpScan up;
+  ScanUp(&up);
+  int c = (up.Gmax[1] > up.Gmax[0] || (up.Gmax[1] == up.Gmax[0] && up.Gmax_idx[1] > up.Gmax_idx[0])) ? 1 : 0;
+  double Gmax = up.Gmax[c];
+  int Gmax_idx = up.Gmax_idx[c];
+  if (Gmax_idx == -1) {  // Gmax+Gmax2 = -kInf
+    return 1;
   }
 
-  for (int j = 0; j < active_size_; ++j) {
-    if (y_[j] == +1) {
-      if (!IsLowerBound(j)) {
-        double grad_diff = Gmax + G_[j];
-        if (G_[j] >= Gmax2) {
-          Gmax2 = G_[j];
-        }
-        if (grad_diff > 0) {
-          double obj_diff;
-          double quad_coef = QD_[i] + QD_[j] - 2.0*y_[i]*Q_i[j];
-          if (quad_coef > 0) {
-            obj_diff = -(grad_diff*grad_diff) / quad_coef;
-          } else {
-            obj_diff = -(grad_diff*grad_diff) / kTau;
-          }
-
-          if (obj_diff <= obj_diff_min) {
-            Gmin_idx = j;
-            obj_diff_min = obj_diff;
-          }
-        }
-      }
-    } else {
-      if (!IsUpperBound(j)) {
-        double grad_diff = Gmax - G_[j];
-        if (-G_[j] >= Gmax2) {
-          Gmax2 = -G_[j];
-        }
-        if (grad_diff > 0) {
-          double obj_diff;
-          double quad_coef = QD_[i] + QD_[j] + 2.0*y_[i]*Q_i[j];
-          if (quad_coef > 0) {
-            obj_diff = -(grad_diff*grad_diff) / quad_coef;
-          } else {
-            obj_diff = -(grad_diff*grad_diff) / kTau;
-          }
-          if (obj_diff <= obj_diff_min) {
-            Gmin_idx = j;
-            obj_diff_min = obj_diff;
-          }
-        }
-      }
-    }
-  }
+  int i = Gmax_idx;
+  LowScan low;
+  low.Gmax[0] = low.Gmax[1] = Gmax;
+  low.Q[0] = low.Q[1] = Q_->get_Q(i, active_size_);
+  low.QD[0] = low.QD[1] = QD_[i];
+  low.coef[0] = 2.0*y_[i];
+  low.coef[1] = -(2.0*y_[i]);
+  ScanLow(&low);
+  double Gmax2 = std::max(low.Gmax2[0], low.Gmax2[1]);
+  int Gmin_idx = low.Gmin_idx;
 
   if (Gmax+Gmax2 < eps_) {
     return 1;
@@ -602,9 +943,9 @@ class Solver_NU : public Solver {
   Solver_NU() {}
   void Solve(int l, const QMatrix& Q, const double *p, const schar *y,
       double *alpha, double Cp, double Cn, double eps,
-      SolutionInfo* si, int shrinking) {
+      SolutionInfo* si, int shrinking, SolverBuffers *buffers) {
     si_ = si;
-    Solver::Solve(l, Q, p, y, alpha, Cp, Cn, eps, si, shrinking);
+    Solver::Solve(l, Q, p, y, alpha, Cp, Cn, eps, si, shrinking, buffers, NULL, NULL);
   }
 
  private:
@@ -623,88 +964,31 @@ int Solver_NU::SelectWorkingSet(int &out_i, int &out_j) {
   //    (if quadratic coefficeint <= 0, replace it with tau)
   //    -y_j*grad(f)_j < -y_i*grad(f)_i, j in I_low(\alpha)
 
-  double Gmaxp = -kInf;
-  double Gmaxp2 = -kInf;
-  int Gmaxp_idx = -1;
-
-  double Gmaxn = -kInf;
-  double Gmaxn2 = -kInf;
-  int Gmaxn_idx = -1;
-
-  int Gmin_idx = -1;
-  double obj_diff_min = kInf;
-
-  for (int t = 0; t < active_size_; ++t)
-    if (y_[t] == +1) {
-      if (!IsUpperBound(t)) {
-        if (-G_[t] >= Gmaxp) {
-          Gmaxp = -G_[t];
-          Gmaxp_idx = t;
-        }
-      }
-    } else {
-      if (!IsLowerBound(t)) {
-        if (G_[t] >= Gmaxn) {
-          Gmaxn = G_[t];
-          Gmaxn_idx = t;
-        }
-      }
-    }
-
-  int ip = Gmaxp_idx;
-  int in = Gmaxn_idx;
-  const Qfloat *Q_ip = NULL;
-  const Qfloat *Q_in = NULL;
-  if (ip != -1) {// NULL Q_ip not accessed: Gmaxp=-kInf if ip=-1
-    Q_ip = Q_->get_Q(ip, active_size_);
-  }
-  if (in != -1) {
-    Q_in = Q_->get_Q(in, active_size_);
+  UpScan up;
+  ScanUp(&up);
+  double Gmaxp = up.Gmax[0];
+  double Gmaxn = up.Gmax[1];
+  int Gmaxp_idx = up.Gmax_idx[0];
+  int Gmaxn_idx = up.Gmax_idx[1];
+  if (Gmaxp_idx == -1 && Gmaxn_idx == -1) {  // Gmaxp+Gmaxp2 = Gmaxn+Gmaxn2 = -kInf
+    return 1;
   }
 
-  for (int j = 0; j < active_size_; ++j) {
-    if (y_[j] == +1) {
-      if (!IsLowerBound(j)) {
-        double grad_diff = Gmaxp + G_[j];
-        if (G_[j] >= Gmaxp2) {
-          Gmaxp2 = G_[j];
-        }
-        if (grad_diff > 0) {
-          double obj_diff;
-          double quad_coef = QD_[ip] + QD_[j] - 2*Q_ip[j];
-          if (quad_coef > 0) {
-            obj_diff = -(grad_diff*grad_diff) / quad_coef;
-          } else {
-            obj_diff = -(grad_diff*grad_diff) / kTau;
-          }
-          if (obj_diff <= obj_diff_min) {
-            Gmin_idx = j;
-            obj_diff_min = obj_diff;
-          }
-        }
-      }
-    } else {
-      if (!IsUpperBound(j)) {
-        double grad_diff = Gmaxn - G_[j];
-        if (-G_[j] >= Gmaxn2) {
-          Gmaxn2 = -G_[j];
-        }
-        if (grad_diff > 0) {
-          double obj_diff;
-          double quad_coef = QD_[in] + QD_[j] - 2*Q_in[j];
-          if (quad_coef > 0) {
-            obj_diff = -(grad_diff*grad_diff) / quad_coef;
-          } else {
-            obj_diff = -(grad_diff*grad_diff) / kTau;
-          }
-          if (obj_diff <= obj_diff_min) {
-            Gmin_idx = j;
-            obj_diff_min = obj_diff;
-          }
-        }
-      }
-    }
-  }
+  // a class without i has Gmax = -kInf, so none of its j is chosen, and the column of the other class stands in
+  int ip = (Gmaxp_idx != -1) ? Gmaxp_idx : Gmaxn_idx;
+  int in = (Gmaxn_idx != -1) ? Gmaxn_idx : Gmaxp_idx;
+  LowScan low;
+  low.Gmax[0] = Gmaxp;
+  low.Gmax[1] = Gmaxn;
+  low.Q[0] = Q_->get_Q(ip, active_size_);
+  low.Q[1] = (in != ip) ? Q_->get_Q(in, active_size_) : low.Q[0];
+  low.QD[0] = QD_[ip];
+  low.QD[1] = QD_[in];
+  low.coef[0] = low.coef[1] = 2;
+  ScanLow(&low);
+  double Gmaxp2 = low.Gmax2[0];
+  double Gmaxn2 = low.Gmax2[1];
+  int Gmin_idx = low.Gmin_idx;
 
   if (std::max(Gmaxp+Gmaxp2, Gmaxn+Gmaxn2) < eps_) {
     return 1;
@@ -843,22 +1127,29 @@ double Solver_NU::CalculateRho() {
 //
 // Q matrices for various formulations
 //
-class SVC_Q : public Kernel {
+// Kernel_Q holds the kernel matrix of the whole training set, grouped into blocks of examples
+// (the classes in TrainSVM), the kernel values between x_i and a block are cached as one entry
+// of a single cache of param.cache_size, which is shared by all the binary subproblems
+//
+class Kernel_Q : public Kernel {
  public:
-  SVC_Q(const Problem &prob, const SVMParameter &param, const schar *y) : Kernel(prob.num_ex, prob.x, param.kernel_param) {
-    clone(y_, y, prob.num_ex);
-    cache_ = new Cache(prob.num_ex, static_cast<long int>(param.cache_size*(1<<20)));
-    QD_ = new double[prob.num_ex];
-    for (int i = 0; i < prob.num_ex; ++i)
-      QD_[i] = (this->*kernel_function)(i, i);
-  }
-
-  Qfloat *get_Q(int i, int len) const {
+  Kernel_Q(int l, Node *const *x, const SVMParameter &param, int num_blocks, const int *start, const int *count, const DenseRows *dense, const SparseIndex *index)
+      : Kernel(l, x, param.kernel_param, dense, index), num_blocks_(num_blocks) {
+    clone(start_, start, num_blocks);
+    clone(count_, count, num_blocks);
+    cache_ = new Cache(l*num_blocks, static_cast<long int>(param.cache_size*(1<<20)));
+    QD_ = new double[l];
+    for (int i = 0; i < l; ++i)
+      QD_[i] = KernelValue(i, i);
+  }
+
+  // kernel values between x_i and the examples of block b (the cache entry i*num_blocks+b)
+  Qfloat *get_Q(int i, int b) const {
     Qfloat *data;
-    int start = cache_->get_data(i, &data, len);
+    int len = count_[b];
+    int start = cache_->get_data(i*num_blocks_+b, &data, len);
     if (start < len) {
-      for (int j = start; j < len; ++j)
-        data[j] = static_cast<Qfloat>(y_[i]*y_[j]*(this->*kernel_function)(i, j));
+      KernelColumn(i, start_[b]+start, len-start, data+start);
     }
     return data;
   }
@@ -867,32 +1158,244 @@ class SVC_Q : public Kernel {
     return QD_;
   }
 
-  void SwapIndex(int i, int j) const {
-    cache_->SwapIndex(i, j);
-    Kernel::SwapIndex(i, j);
-    std::swap(y_[i], y_[j]);
-    std::swap(QD_[i], QD_[j]);
+  // appends the rows x[l,new_l) to a kernel_Q of a single block made with neither dense rows nor an inverted
+  // index, the cached columns are kept and filled up to new_l when they are read again
+  void Grow(int new_l, Node *const *x) {
+    int l = count_[0];
+    if (new_l <= l) {
+      return;
+    }
+    AppendRows(l, new_l, x);
+    cache_->Grow(new_l);
+    double *QD = new double[new_l];
+    std::copy(QD_, QD_+l, QD);
+    delete[] QD_;
+    QD_ = QD;
+    for (int i = l; i < new_l; ++i)
+      QD_[i] = KernelValue(i, i);
+    count_[0] = new_l;
+  }
+
+  int get_num_blocks() const {
+    return num_blocks_;
   }
 
-  ~SVC_Q() {
-    delete[] y_;
+  const int *get_start() const {
+    return start_;
+  }
+
+  ~Kernel_Q() {
+    delete[] start_;
+    delete[] count_;
     delete cache_;
     delete[] QD_;
   }
 
  private:
-  schar *y_;
+  int num_blocks_;
+  int *start_;
+  int *count_;
   Cache *cache_;
   double *QD_;
 };
 
+//
+// SVC_Q is the Q matrix of a binary subproblem, index[i] is the row of example i in kernel_Q,
+// its columns are gathered from the blocks of kernel_Q with the signs y_i*y_j applied
+// (at most two columns returned by get_Q are used at the same time by the solvers),
+// its arrays are taken from buffers
+//
+class SVC_Q : public QMatrix {
+ public:
+  SVC_Q(const Problem &prob, const schar *y, const int *index, const Kernel_Q &kernel_Q, SolverBuffers *buffers) : kernel_Q_(kernel_Q), next_buffer_(0) {
+    int l = prob.num_ex;
+    int num_blocks = kernel_Q_.get_num_blocks();
+    const int *start = kernel_Q_.get_start();
+
+    y_ = buffers->Q_y.get(l);
+    std::copy(y, y+l, y_);
+    QD_ = buffers->Q_QD.get(l);
+    block_ = buffers->Q_block.get(l);
+    offset_ = buffers->Q_offset.get(l);
+    for (int i = 0; i < l; ++i) {
+      QD_[i] = kernel_Q_.get_QD()[index[i]];
+      int b = num_blocks-1;
+      while (start[b] > index[i]) {
+        --b;
+      }
+      block_[i] = b;
+      offset_[i] = index[i] - start[b];
+      if (std::find(blocks_.begin(), blocks_.end(), b) == blocks_.end()) {
+        blocks_.push_back(b);
+      }
+    }
+    index_ = buffers->Q_index.get(l);
+    for (int i = 0; i < l; ++i) {
+      index_[i] = index[i];
+    }
+    data_ = buffers->Q_data.get(num_blocks);
+    needed_.assign(static_cast<std::size_t>(num_blocks), 0);
+    buffer_[0] = buffers->Q_buffer[0].get(l);
+    buffer_[1] = buffers->Q_buffer[1].get(l);
+  }
+
+  // only the blocks of the first len (active) examples are fetched, so that shrinking saves kernel evaluations
+  Qfloat *get_Q(int i, int len) const {
+    std::size_t num_needed = 0;
+    for (int j = 0; j < len && num_needed < blocks_.size(); ++j) {
+      if (!needed_[static_cast<std::size_t>(block_[j])]) {
+        needed_[static_cast<std::size_t>(block_[j])] = 1;
+        ++num_needed;
+      }
+    }
+    for (std::size_t k = 0; k < blocks_.size(); ++k) {
+      if (needed_[static_cast<std::size_t>(blocks_[k])]) {
+        data_[blocks_[k]] = kernel_Q_.get_Q(index_[i], blocks_[k]);
+        needed_[static_cast<std::size_t>(blocks_[k])] = 0;
+      }
+    }
+    Qfloat *data = buffer_[next_buffer_];
+    next_buffer_ ^= 1;
+    ParallelRange(kernel_Q_.get_pool(), len, [this, i, data](int, int start, int end) {
+      for (int j = start; j < end; ++j)
+        data[j] = static_cast<Qfloat>(y_[i]*y_[j]*data_[block_[j]][offset_[j]]);
+    });
+    return data;
+  }
+
+  double *get_QD() const {
+    return QD_;
+  }
+
+  WorkerPool *get_pool() const {
+    return kernel_Q_.get_pool();
+  }
+
+  void SwapIndex(int i, int j) const {
+    std::swap(index_[i], index_[j]);
+    std::swap(block_[i], block_[j]);
+    std::swap(offset_[i], offset_[j]);
+    std::swap(y_[i], y_[j]);
+    std::swap(QD_[i], QD_[j]);
+  }
+
+ private:
+  const Kernel_Q &kernel_Q_;
+  schar *y_;
+  int *index_;
+  int *block_;  // block of example i in kernel_Q
+  int *offset_;  // position of example i in its block
+  std::vector<int> blocks_;  // blocks used by this subproblem
+  mutable std::vector<char> needed_;  // blocks of the active examples, all zeros between calls to get_Q
+  double *QD_;
+  const Qfloat **data_;
+  Qfloat *buffer_[2];
+  mutable int next_buffer_;
+};
+
+//
+// Workspace of TrainSVM
+//
+// a binary subproblem of C_SVC (the classes pos_label and neg_label) or OVA_SVC (pos_label against all the others)
+// kept by an incremental workspace: its examples in the order they arrived (index[k] is their row in the kernels),
+// the solution of the solver with its gradient, and the bounds it was solved with
+struct Subproblem {
+  int pos_label;
+  int neg_label;
+  bool one_vs_all;
+  int num_ex;  // the examples of the training set up to num_ex have been added
+  std::vector<int> index;
+  std::vector<schar> y;
+  std::vector<double> alpha;
+  std::vector<double> G;
+  std::vector<double> G_bar;
+  double Cp;
+  double Cn;
+  double rho;
+};
+
+// one SolverBuffers and one worker pool (NULL until a subproblem is large enough to split) for each of
+// the threads of TrainSVM, and for an incremental workspace the training set and the parameter of the
+// last call, a growing kernel over the training set for each thread and the subproblems of C_SVC or OVA_SVC
+struct SVMWorkspace {
+  std::vector<SolverBuffers*> threads;
+  std::vector<WorkerPool*> pools;
+  bool incremental;
+  std::vector<Node*> x;
+  std::vector<double> y;
+  SVMParameter param;
+  KernelParameter kernel_param;
+  std::vector<int> weight_labels;
+  std::vector<double> weights;
+  std::vector<Kernel_Q*> kernel_Q;
+  std::vector<Subproblem*> subproblems;
+};
+
+SVMWorkspace *MakeSVMWorkspace() {
+  return MakeSVMWorkspace(false);
+}
+
+SVMWorkspace *MakeSVMWorkspace(bool incremental) {
+  SVMWorkspace *workspace = new SVMWorkspace;
+  workspace->incremental = incremental;
+
+  return workspace;
+}
+
+// forgets the training set and the subproblems of an incremental workspace
+static void ClearIncremental(SVMWorkspace *workspace) {
+  for (std::size_t i = 0; i < workspace->kernel_Q.size(); ++i) {
+    delete workspace->kernel_Q[i];
+  }
+  for (std::size_t i = 0; i < workspace->subproblems.size(); ++i) {
+    delete workspace->subproblems[i];
+  }
+  workspace->kernel_Q.clear();
+  workspace->subproblems.clear();
+  workspace->x.clear();
+  workspace->y.clear();
+
+  return;
+}
+
+void FreeSVMWorkspace(SVMWorkspace *workspace) {
+  for (std::size_t i = 0; i < workspace->threads.size(); ++i) {
+    delete workspace->threads[i];
+  }
+  for (std::size_t i = 0; i < workspace->pools.size(); ++i) {
+    if (workspace->pools[i] != NULL) {
+      delete workspace->pools[i];
+    }
+  }
+  ClearIncremental(workspace);
+  delete workspace;
+
+  return;
+}
+
+// the worker pool of thread i, made again if it does not have pool_threads threads, NULL for a single thread
+static WorkerPool *GetPool(SVMWorkspace *workspace, int i, int pool_threads) {
+  if (pool_threads <= 1) {
+    return NULL;
+  }
+  WorkerPool *&pool = workspace->pools[static_cast<std::size_t>(i)];
+  if (pool == NULL || pool->get_num_threads() != pool_threads) {
+    if (pool != NULL) {
+      delete pool;
+    }
+    pool = new WorkerPool(pool_threads);
+  }
+
+  return pool;
+}
+
 //
 // construct and solve various formulations
 //
-static void SolveCSVC(const Problem *prob, const SVMParameter *param, double *alpha, Solver::SolutionInfo *si, double Cp, double Cn) {
+static void SolveCSVC(const Problem *prob, const SVMParameter *param, const int *index, const Kernel_Q &kernel_Q, double *alpha, Solver::SolutionInfo *si, double Cp, double Cn, const double *init_alpha, SolverBuffers *buffers) {
   int num_ex = prob->num_ex;
-  double *minus_ones = new double[num_ex];
-  schar *y = new schar[num_ex];
+  double *minus_ones = buffers->p.get(num_ex);
+  schar *y = buffers->y.get(num_ex);
 
   for (int i = 0; i < num_ex; ++i) {
     alpha[i] = 0;
@@ -904,8 +1407,27 @@ static void SolveCSVC(const Problem *prob, const SVMParameter *param, double *al
     }
   }
 
+  // warm start from init_alpha, clipped to the box of this problem (Cn of OVA_SVC changes with num_ex)
+  // and then decreased on the larger side until y^T alpha = 0 holds again
+  if (init_alpha != NULL) {
+    double sum = 0;
+    for (int i = 0; i < num_ex; ++i) {
+      alpha[i] = std::max(0.0, std::min(init_alpha[i], (y[i] == +1) ? Cp : Cn));
+      sum += y[i] * alpha[i];
+    }
+    schar side = (sum > 0) ? +1 : -1;
+    sum = fabs(sum);
+    for (int i = 0; i < num_ex && sum > 0; ++i) {
+      if (y[i] == side) {
+        double delta = std::min(alpha[i], sum);
+        alpha[i] -= delta;
+        sum -= delta;
+      }
+    }
+  }
+
   Solver s;
-  s.Solve(num_ex, SVC_Q(*prob, *param, y), minus_ones, y, alpha, Cp, Cn, param->eps, si, param->shrinking);
+  s.Solve(num_ex, SVC_Q(*prob, y, index, kernel_Q, buffers), minus_ones, y, alpha, Cp, Cn, param->eps, si, param->shrinking, buffers, NULL, NULL);
 
   double sum_alpha=0;
   for (int i = 0; i < num_ex; ++i) {
@@ -919,16 +1441,13 @@ static void SolveCSVC(const Problem *prob, const SVMParameter *param, double *al
   for (int i = 0; i < num_ex; ++i) {
     alpha[i] *= y[i];
   }
-
-  delete[] minus_ones;
-  delete[] y;
 }
 
-static void SolveNuSVC(const Problem *prob, const SVMParameter *param, double *alpha, Solver::SolutionInfo *si) {
+static void SolveNuSVC(const Problem *prob, const SVMParameter *param, const int *index, const Kernel_Q &kernel_Q, double *alpha, Solver::SolutionInfo *si, SolverBuffers *buffers) {
   int num_ex = prob->num_ex;
   double nu = param->nu;
 
-  schar *y = new schar[num_ex];
+  schar *y = buffers->y.get(num_ex);
 
   for (int i = 0; i < num_ex; ++i) {
     if (prob->y[i] > 0) {
@@ -951,14 +1470,14 @@ static void SolveNuSVC(const Problem *prob, const SVMParameter *param, double *a
     }
   }
 
-  double *zeros = new double[num_ex];
+  double *zeros = buffers->p.get(num_ex);
 
   for (int i = 0; i < num_ex; ++i) {
     zeros[i] = 0;
   }
 
   Solver_NU s;
-  s.Solve(num_ex, SVC_Q(*prob, *param, y), zeros, y, alpha, 1.0, 1.0, param->eps, si, param->shrinking);
+  s.Solve(num_ex, SVC_Q(*prob, y, index, kernel_Q, buffers), zeros, y, alpha, 1.0, 1.0, param->eps, si, param->shrinking, buffers);
   double r = si->r;
 
   Info("C = %f\n", 1/r);
@@ -971,9 +1490,263 @@ static void SolveNuSVC(const Problem *prob, const SVMParameter *param, double *a
   si->obj /= (r*r);
   si->upper_bound_p = 1/r;
   si->upper_bound_n = 1/r;
+}
+
+// adds the examples of prob that arrived after the last solution of s (alpha = 0), moves the alphas into
+// the bounds Cp and Cn (Cn of OVA_SVC changes with num_ex) and solves s again from there, the gradient of a
+// new example comes from its own column and each alpha or bound moved adds the column of its example,
+// so the gradient of the last solution is kept and the kernel cache is only extended by the new rows
+static void SolveSubproblem(const Problem *prob, const SVMParameter *param, const Kernel_Q &kernel_Q, Subproblem *s, double Cp, double Cn, SolverBuffers *buffers) {
+  int old_l = static_cast<int>(s->index.size());
+  for (int i = s->num_ex; i < prob->num_ex; ++i) {
+    int label = static_cast<int>(prob->y[i]);
+    if (label == s->pos_label || label == s->neg_label || s->one_vs_all) {
+      s->index.push_back(i);
+      s->y.push_back((label == s->pos_label) ? +1 : -1);
+      s->alpha.push_back(0);
+      s->G.push_back(-1);
+      s->G_bar.push_back(0);
+    }
+  }
+  s->num_ex = prob->num_ex;
+  int l = static_cast<int>(s->index.size());
+  schar *y = &s->y[0];
+  double *alpha = &s->alpha[0];
+  double *G = &s->G[0];
+  double *G_bar = &s->G_bar[0];
+
+  Problem sub_prob;
+  sub_prob.num_ex = l;
+  SVC_Q Q(sub_prob, y, &s->index[0], kernel_Q, buffers);
+
+  bool has_sv = false;
+  for (int k = 0; k < old_l; ++k) {
+    if (alpha[k] > 0) {
+      has_sv = true;
+      break;
+    }
+  }
+  for (int t = old_l; t < l && has_sv; ++t) {
+    const Qfloat *Q_t = Q.get_Q(t, old_l);
+    for (int k = 0; k < old_l; ++k) {
+      if (alpha[k] > 0) {
+        G[t] += alpha[k] * Q_t[k];
+        double C_k = (y[k] > 0) ? s->Cp : s->Cn;
+        if (alpha[k] >= C_k) {
+          G_bar[t] += C_k * Q_t[k];
+        }
+      }
+    }
+  }
+
+  // the alphas are clipped to the new bounds and then decreased on the larger side until y^T alpha = 0 holds again
+  double *new_alpha = buffers->init_alpha.get(l);
+  double sum = 0;
+  for (int k = 0; k < l; ++k) {
+    new_alpha[k] = std::min(alpha[k], (y[k] > 0) ? Cp : Cn);
+    sum += y[k] * new_alpha[k];
+  }
+  schar side = (sum > 0) ? +1 : -1;
+  sum = fabs(sum);
+  for (int k = 0; k < l && sum > 0; ++k) {
+    if (y[k] == side) {
+      double delta = std::min(new_alpha[k], sum);
+      new_alpha[k] -= delta;
+      sum -= delta;
+    }
+  }
+  for (int k = 0; k < l; ++k) {
+    double old_C = (y[k] > 0) ? s->Cp : s->Cn;
+    double new_C = (y[k] > 0) ? Cp : Cn;
+    double delta = new_alpha[k] - alpha[k];
+    double delta_bar = ((new_alpha[k] >= new_C) ? new_C : 0) - ((alpha[k] > 0 && alpha[k] >= old_C) ? old_C : 0);
+    if (delta != 0 || delta_bar != 0) {
+      const Qfloat *Q_k = Q.get_Q(k, l);
+      for (int j = 0; j < l; ++j) {
+        G[j] += delta * Q_k[j];
+        G_bar[j] += delta_bar * Q_k[j];
+      }
+      alpha[k] = new_alpha[k];
+    }
+  }
+
+  double *minus_ones = buffers->p.get(l);
+  for (int k = 0; k < l; ++k) {
+    minus_ones[k] = -1;
+  }
+  Solver::SolutionInfo si;
+  Solver solver;
+  solver.Solve(l, Q, minus_ones, y, alpha, Cp, Cn, param->eps, &si, param->shrinking, buffers, G, G_bar);
+  s->Cp = Cp;
+  s->Cn = Cn;
+  s->rho = si.rho;
+
+  Info("obj = %f, rho = %f\n", si.obj, si.rho);
+
+  return;
+}
+
+// A dual coordinate descent method in Hsieh et al., ICML 2008, as in LIBLINEAR
+// Solves:
+//
+//  min 0.5(\alpha^T (Q+D) \alpha) - e^T \alpha
+//
+//    0 <= alpha_i <= U_i
+//
+// where Q_ij = y_i*y_j*(x_i^T x_j + 1), the 1 for the bias term, and
+//
+//  L1-loss: U_i = C_i, D_ii = 0
+//  L2-loss: U_i = kInf, D_ii = 1/(2*C_i)
+//
+// w = \sum y_i*alpha_i*x_i and the bias b = \sum y_i*alpha_i are kept up to date, so that each step costs the
+// number of non-zeros of x_i, the examples are visited in a random order from a fixed seed, so training
+// is reproducible, and with shrinking the bounded alpha_i whose gradients stay outside the last range are
+// left out until the active ones are optimal
+//
+static void SolveLinearSVC(const Problem *prob, const SVMParameter *param, double *alpha, Solver::SolutionInfo *si, double Cp, double Cn, const double *init_alpha, SolverBuffers *buffers) {
+  int num_ex = prob->num_ex;
+  Node *const *x = prob->x;
+  bool l2_loss = (param->svm_type == L2_LINEAR_SVC);
+  // indexed by y_i+1
+  double diag[3] = { l2_loss ? 0.5/Cn : 0, 0, l2_loss ? 0.5/Cp : 0 };
+  double upper_bound[3] = { l2_loss ? kInf : Cn, 0, l2_loss ? kInf : Cp };
+
+  schar *y = buffers->y.get(num_ex);
+  double *QD = buffers->QD.get(num_ex);
+  int *index = buffers->index.get(num_ex);
+
+  int max_index = 0;
+  for (int i = 0; i < num_ex; ++i) {
+    for (const Node *px = x[i]; px->index != -1; ++px) {
+      max_index = std::max(max_index, px->index);
+    }
+  }
+  double *w = buffers->w.get(max_index+1);
+  for (int k = 0; k <= max_index; ++k) {
+    w[k] = 0;
+  }
+  double b = 0;
+
+  for (int i = 0; i < num_ex; ++i) {
+    y[i] = (prob->y[i] > 0) ? +1 : -1;
+    alpha[i] = (init_alpha != NULL) ? std::max(0.0, std::min(init_alpha[i], upper_bound[y[i]+1])) : 0;
+    QD[i] = diag[y[i]+1] + 1;
+    for (const Node *px = x[i]; px->index != -1; ++px) {
+      QD[i] += px->value * px->value;
+      w[px->index] += y[i] * alpha[i] * px->value;
+    }
+    b += y[i] * alpha[i];
+    index[i] = i;
+  }
+
+  std::mt19937 g(0);
+  int active_size = num_ex;
+  double PGmax_old = kInf;
+  double PGmin_old = -kInf;
+  int iter = 0;
+  int max_iter = 1000;
+
+  while (iter < max_iter) {
+    double PGmax_new = -kInf;
+    double PGmin_new = kInf;
+
+    for (int s = 0; s < active_size; ++s) {
+      std::uniform_int_distribution<int> pick(s, active_size-1);
+      std::swap(index[s], index[pick(g)]);
+    }
+
+    for (int s = 0; s < active_size; ++s) {
+      int i = index[s];
+      schar yi = y[i];
+      double U = upper_bound[yi+1];
+
+      double G = b;
+      for (const Node *px = x[i]; px->index != -1; ++px) {
+        G += w[px->index] * px->value;
+      }
+      G = G*yi - 1 + alpha[i]*diag[yi+1];
+
+      double PG = 0;
+      if (alpha[i] == 0) {
+        if (G > PGmax_old) {
+          --active_size;
+          std::swap(index[s], index[active_size]);
+          --s;
+          continue;
+        } else if (G < 0) {
+          PG = G;
+        }
+      } else if (alpha[i] == U) {
+        if (G < PGmin_old) {
+          --active_size;
+          std::swap(index[s], index[active_size]);
+          --s;
+          continue;
+        } else if (G > 0) {
+          PG = G;
+        }
+      } else {
+        PG = G;
+      }
+
+      PGmax_new = std::max(PGmax_new, PG);
+      PGmin_new = std::min(PGmin_new, PG);
+
+      if (fabs(PG) > kTau) {
+        double alpha_old = alpha[i];
+        alpha[i] = std::min(std::max(alpha[i] - G/QD[i], 0.0), U);
+        double d = (alpha[i] - alpha_old) * yi;
+        for (const Node *px = x[i]; px->index != -1; ++px) {
+          w[px->index] += d * px->value;
+        }
+        b += d;
+      }
+    }
+
+    ++iter;
+    if (iter % 10 == 0) {
+      Info(".");
+    }
 
-  delete[] y;
-  delete[] zeros;
+    if (PGmax_new - PGmin_new <= param->eps) {
+      if (active_size == num_ex) {
+        break;
+      } else {
+        active_size = num_ex;
+        Info("*");
+        PGmax_old = kInf;
+        PGmin_old = -kInf;
+        continue;
+      }
+    }
+    PGmax_old = PGmax_new;
+    PGmin_old = PGmin_new;
+    if (PGmax_old <= 0 || !param->shrinking) {
+      PGmax_old = kInf;
+    }
+    if (PGmin_old >= 0 || !param->shrinking) {
+      PGmin_old = -kInf;
+    }
+  }
+
+  Info("\noptimization finished, #iter = %d\n", iter);
+  if (iter >= max_iter) {
+    std::cerr << "\nWARNING: reaching max number of iterations" << std::endl;
+  }
+
+  // calculate objective value
+  double v = b*b;
+  for (int k = 0; k <= max_index; ++k) {
+    v += w[k] * w[k];
+  }
+  for (int i = 0; i < num_ex; ++i) {
+    v += alpha[i] * (alpha[i]*diag[y[i]+1] - 2);
+    alpha[i] *= y[i];
+  }
+  si->obj = v / 2;
+  si->rho = -b;
+  si->upper_bound_p = upper_bound[2];
+  si->upper_bound_n = upper_bound[0];
 }
 
 //
@@ -984,20 +1757,27 @@ struct DecisionFunction {
   double rho;
 };
 
-static DecisionFunction TrainSingleSVM(const Problem *prob, const SVMParameter *param, double Cp, double Cn) {
+// index[i] is the row of prob->x[i] in kernel_Q, kernel_Q is NULL for the linear SVCs,
+// the arrays of the solvers are taken from buffers
+static DecisionFunction TrainSingleSVM(const Problem *prob, const SVMParameter *param, const int *index, const Kernel_Q *kernel_Q, double Cp, double Cn, const double *init_alpha, SolverBuffers *buffers) {
   double *alpha = new double[prob->num_ex];
   Solver::SolutionInfo si;
   switch (param->svm_type) {
     case C_SVC: {
-      SolveCSVC(prob, param, alpha, &si, Cp, Cn);
+      SolveCSVC(prob, param, index, *kernel_Q, alpha, &si, Cp, Cn, init_alpha, buffers);
       break;
     }
     case OVA_SVC: {
-      SolveCSVC(prob, param, alpha, &si, Cp, Cn);
+      SolveCSVC(prob, param, index, *kernel_Q, alpha, &si, Cp, Cn, init_alpha, buffers);
       break;
     }
     case NU_SVC: {
-      SolveNuSVC(prob, param, alpha, &si);
+      SolveNuSVC(prob, param, index, *kernel_Q, alpha, &si, buffers);
+      break;
+    }
+    case L1_LINEAR_SVC:
+    case L2_LINEAR_SVC: {
+      SolveLinearSVC(prob, param, alpha, &si, Cp, Cn, init_alpha, buffers);
       break;
     }
     default: {
@@ -1034,10 +1814,379 @@ static DecisionFunction TrainSingleSVM(const Problem *prob, const SVMParameter *
   return f;
 }
 
+//
+// warm start
+//
+// row of sv_coef that holds the coefficient of an SV of class c in the classifier against class o
+static inline int GetCoefRow(int c, int o) {
+  return (o > c) ? o-1 : o;
+}
+
+// init_sv[i]: index of x[i] in init_model->svs, or -1 if x[i] is not an SV of init_model
+// init_class[i]: index of labels[i] in init_model->labels, or -1 if init_model has no such class
+static void MapInitModel(const SVMModel *init_model, int num_ex, const int *perm, int num_classes, const int *labels, int *init_sv, int *init_class) {
+  int *sv_of_ex = new int[num_ex];
+
+  for (int i = 0; i < num_ex; ++i) {
+    sv_of_ex[i] = -1;
+  }
+  for (int i = 0; i < init_model->total_sv; ++i) {
+    int index = init_model->sv_indices[i] - 1;
+    if (index >= 0 && index < num_ex) {
+      sv_of_ex[index] = i;
+    }
+  }
+  for (int i = 0; i < num_ex; ++i) {
+    init_sv[i] = sv_of_ex[perm[i]];
+  }
+  for (int i = 0; i < num_classes; ++i) {
+    init_class[i] = -1;
+    for (int j = 0; j < init_model->num_classes; ++j) {
+      if (init_model->labels[j] == labels[i]) {
+        init_class[i] = j;
+        break;
+      }
+    }
+  }
+  delete[] sv_of_ex;
+
+  return;
+}
+
+// class of the SV init_sv in init_model
+static int GetSVClass(const SVMModel *init_model, int init_sv) {
+  int c = 0;
+  int end = init_model->num_svs[0];
+
+  while (init_sv >= end) {
+    end += init_model->num_svs[++c];
+  }
+
+  return c;
+}
+
+static double GetInitAlpha(const SVMModel *init_model, int init_sv, int init_other) {
+  if (init_sv == -1) {
+    return 0;
+  }
+  int c = GetSVClass(init_model, init_sv);
+  if (init_model->param.svm_type == OVA_SVC) {
+    return fabs(init_model->sv_coef[init_other][init_sv]);
+  }
+
+  return fabs(init_model->sv_coef[GetCoefRow(c, init_other)][init_sv]);
+}
+
+//
+// incremental training
+//
+// whether the subproblems kept in workspace were solved with the same parameter (but maybe another num_threads)
+static bool SameParam(const SVMWorkspace *workspace, const SVMParameter *param) {
+  const SVMParameter &kept = workspace->param;
+  const KernelParameter &kernel = workspace->kernel_param;
+  if (kept.svm_type != param->svm_type || kept.cache_size != param->cache_size || kept.eps != param->eps ||
+      kept.C != param->C || kept.shrinking != param->shrinking || kept.num_weights != param->num_weights ||
+      kernel.kernel_type != param->kernel_param->kernel_type || kernel.degree != param->kernel_param->degree ||
+      kernel.gamma != param->kernel_param->gamma || kernel.coef0 != param->kernel_param->coef0) {
+    return false;
+  }
+  for (int i = 0; i < param->num_weights; ++i) {
+    if (workspace->weight_labels[static_cast<std::size_t>(i)] != param->weight_labels[i] ||
+        workspace->weights[static_cast<std::size_t>(i)] != param->weights[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// the subproblem of the classes pos_label and neg_label (in either order) or of OVA_SVC for pos_label,
+// made empty if workspace does not have it
+static Subproblem *FindSubproblem(SVMWorkspace *workspace, int pos_label, int neg_label, bool one_vs_all) {
+  for (std::size_t i = 0; i < workspace->subproblems.size(); ++i) {
+    Subproblem *s = workspace->subproblems[i];
+    if ((one_vs_all && s->pos_label == pos_label) ||
+        (!one_vs_all && ((s->pos_label == pos_label && s->neg_label == neg_label) ||
+                         (s->pos_label == neg_label && s->neg_label == pos_label)))) {
+      return s;
+    }
+  }
+  Subproblem *s = new Subproblem;
+  s->pos_label = pos_label;
+  s->neg_label = neg_label;
+  s->one_vs_all = one_vs_all;
+  s->num_ex = 0;
+  s->Cp = 0;
+  s->Cn = 0;
+  s->rho = 0;
+  workspace->subproblems.push_back(s);
+
+  return s;
+}
+
+// the decision functions f of C_SVC (the pairs of classes in the order of TrainSVM) or OVA_SVC from the
+// subproblems kept in an incremental workspace, which are forgotten unless prob starts with the training set
+// of the last call and param is the same, only the subproblems that get new examples or new bounds are solved
+// again, on num_threads threads with a kernel of cache_size/num_threads over prob for each of them
+static void TrainIncremental(const Problem *prob, const SVMParameter *param, int num_classes, const int *labels,
+    const int *start, const int *count, const int *perm, const double *weighted_C,
+    int num_threads, int pool_threads, DecisionFunction *f, SVMWorkspace *workspace) {
+  int num_ex = prob->num_ex;
+  std::size_t old_num_ex = workspace->x.size();
+  bool same = SameParam(workspace, param) && old_num_ex <= static_cast<std::size_t>(num_ex);
+  for (std::size_t i = 0; i < old_num_ex && same; ++i) {
+    same = (workspace->x[i] == prob->x[i] && workspace->y[i] == prob->y[i]);
+  }
+  if (!same) {
+    ClearIncremental(workspace);
+    workspace->param = *param;
+    workspace->kernel_param = *param->kernel_param;
+    workspace->weight_labels.assign(param->weight_labels, param->weight_labels+param->num_weights);
+    workspace->weights.assign(param->weights, param->weights+param->num_weights);
+  }
+  workspace->x.assign(prob->x, prob->x+num_ex);
+  workspace->y.assign(prob->y, prob->y+num_ex);
+
+  // the kernels are made again when the number of threads changes, so that they share cache_size
+  if (workspace->kernel_Q.size() != static_cast<std::size_t>(num_threads)) {
+    for (std::size_t i = 0; i < workspace->kernel_Q.size(); ++i) {
+      delete workspace->kernel_Q[i];
+    }
+    workspace->kernel_Q.clear();
+    SVMParameter thread_param = *param;
+    thread_param.cache_size /= num_threads;
+    int zero = 0;
+    for (int i = 0; i < num_threads; ++i) {
+      workspace->kernel_Q.push_back(new Kernel_Q(num_ex, prob->x, thread_param, 1, &zero, &num_ex, NULL, NULL));
+    }
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    workspace->kernel_Q[static_cast<std::size_t>(i)]->Grow(num_ex, prob->x);
+    workspace->kernel_Q[static_cast<std::size_t>(i)]->set_pool(GetPool(workspace, i, pool_threads));
+  }
+
+  // the classes i and j of each decision function (j = -1 for OVA_SVC), its subproblem and their bounds
+  bool one_vs_all = (param->svm_type == OVA_SVC);
+  std::vector<int> pair_i, pair_j;
+  std::vector<Subproblem*> subproblems;
+  std::vector<double> Cp, Cn;
+  for (int i = 0; i < num_classes; ++i) {
+    if (one_vs_all) {
+      pair_i.push_back(i);
+      pair_j.push_back(-1);
+      subproblems.push_back(FindSubproblem(workspace, labels[i], 0, true));
+      Cp.push_back(weighted_C[i]);
+      Cn.push_back(param->C * count[i] / (num_ex - count[i]));
+      continue;
+    }
+    for (int j = i+1; j < num_classes; ++j) {
+      Subproblem *s = FindSubproblem(workspace, labels[i], labels[j], false);
+      bool flip = (s->pos_label != labels[i]);
+      pair_i.push_back(i);
+      pair_j.push_back(j);
+      subproblems.push_back(s);
+      Cp.push_back(weighted_C[flip ? j : i]);
+      Cn.push_back(weighted_C[flip ? i : j]);
+    }
+  }
+  int num_tasks = static_cast<int>(subproblems.size());
+
+  std::vector<int> tasks;
+  for (int p = 0; p < num_tasks; ++p) {
+    Subproblem *s = subproblems[static_cast<std::size_t>(p)];
+    bool grows = false;
+    for (int i = s->num_ex; i < num_ex && !grows; ++i) {
+      int label = static_cast<int>(prob->y[i]);
+      grows = (s->one_vs_all || label == s->pos_label || label == s->neg_label);
+    }
+    if (grows || s->Cp != Cp[static_cast<std::size_t>(p)] || s->Cn != Cn[static_cast<std::size_t>(p)]) {
+      tasks.push_back(p);
+    } else {
+      s->num_ex = num_ex;
+    }
+  }
+  ParallelFor(static_cast<int>(tasks.size()), num_threads, [&](int task, int thread) {
+    std::size_t p = static_cast<std::size_t>(tasks[static_cast<std::size_t>(task)]);
+    SolveSubproblem(prob, param, *workspace->kernel_Q[static_cast<std::size_t>(thread)], subproblems[p], Cp[p], Cn[p],
+                    workspace->threads[static_cast<std::size_t>(thread)]);
+  });
+
+  // the alphas (with the signs of y) are put in the order of the subproblems of TrainSVM, in which the examples
+  // are grouped by perm, class i before class j, and the sign of rho follows class i
+  int *position = new int[num_ex];
+  for (int i = 0; i < num_ex; ++i) {
+    position[perm[i]] = i;
+  }
+  for (int p = 0; p < num_tasks; ++p) {
+    const Subproblem *s = subproblems[static_cast<std::size_t>(p)];
+    int i = pair_i[static_cast<std::size_t>(p)], j = pair_j[static_cast<std::size_t>(p)];
+    double sign = (s->pos_label == labels[i]) ? 1 : -1;
+    f[p].alpha = new double[one_vs_all ? num_ex : count[i]+count[j]];
+    f[p].rho = sign * s->rho;
+    for (std::size_t k = 0; k < s->index.size(); ++k) {
+      int q = position[s->index[k]];
+      if (!one_vs_all) {
+        q = (q >= start[i] && q < start[i]+count[i]) ? q-start[i] : count[i]+q-start[j];
+      }
+      f[p].alpha[q] = sign * s->y[k] * s->alpha[k];
+    }
+  }
+  delete[] position;
+
+  return;
+}
+
+//
+// prediction
+//
+// w += coef[k] * svs[k] for k in [start,start+count)
+static void AddSVs(double *w, const SVMModel *model, const double *coef, int start, int count) {
+  for (int k = start; k < start+count; ++k) {
+    for (const Node *px = model->svs[k]; px->index != -1; ++px) {
+      w[px->index] += coef[k] * px->value;
+    }
+  }
+}
+
+// stores w[0,...,max_index] as the p-th weight vector of model, dense or sparse
+static void StoreWeights(SVMModel *model, int p, const double *w) {
+  int dim = model->max_index+1;
+  if (model->w != NULL) {
+    clone(model->w[p], w, dim);
+    return;
+  }
+  int nnz = 0;
+  for (int k = 0; k < dim; ++k) {
+    if (w[k] != 0) {
+      ++nnz;
+    }
+  }
+  model->sparse_w[p] = new Node[nnz+1];
+  nnz = 0;
+  for (int k = 0; k < dim; ++k) {
+    if (w[k] != 0) {
+      model->sparse_w[p][nnz].index = k;
+      model->sparse_w[p][nnz].value = w[k];
+      ++nnz;
+    }
+  }
+  model->sparse_w[p][nnz].index = -1;
+  model->sparse_w[p][nnz].value = 0;
+
+  return;
+}
+
+// the models with the linear kernel are folded into one weight vector for each decision function, so that
+// prediction costs the non-zeros of x whatever the number of SVs, the weight vectors are dense unless less
+// than half of the features up to max_index occur in the SVs, the other models keep the kernel values with the SVs
+static void SetPredictor(SVMModel *model) {
+  model->sv_kernel = NULL;
+  model->w = NULL;
+  model->sparse_w = NULL;
+  model->max_index = 0;
+  if (model->param.kernel_param->kernel_type != LINEAR) {
+    model->sv_kernel = new SVKernel(model->total_sv, model->svs, model->param.kernel_param);
+    return;
+  }
+
+  int num_classes = model->num_classes;
+  int num_functions = (model->param.svm_type == OVA_SVC) ? num_classes : num_classes*(num_classes-1)/2;
+  for (int i = 0; i < model->total_sv; ++i) {
+    for (const Node *px = model->svs[i]; px->index != -1; ++px) {
+      model->max_index = std::max(model->max_index, px->index);
+    }
+  }
+  int dim = model->max_index+1;
+  double *w = new double[dim];
+  for (int k = 0; k < dim; ++k) {
+    w[k] = 0;
+  }
+  int num_features = 0;
+  for (int i = 0; i < model->total_sv; ++i) {
+    for (const Node *px = model->svs[i]; px->index != -1; ++px) {
+      if (w[px->index] == 0) {
+        w[px->index] = 1;
+        ++num_features;
+      }
+    }
+  }
+  if (2*num_features >= dim) {
+    model->w = new double*[num_functions];
+  } else {
+    model->sparse_w = new Node*[num_functions];
+  }
+
+  if (model->param.svm_type == OVA_SVC) {
+    for (int i = 0; i < num_classes; ++i) {
+      for (int k = 0; k < dim; ++k) {
+        w[k] = 0;
+      }
+      AddSVs(w, model, model->sv_coef[i], 0, model->total_sv);
+      StoreWeights(model, i, w);
+    }
+    delete[] w;
+    return;
+  }
+
+  int *start = new int[num_classes];
+  start[0] = 0;
+  for (int i = 1; i < num_classes; ++i) {
+    start[i] = start[i-1] + model->num_svs[i-1];
+  }
+  int p = 0;
+  for (int i = 0; i < num_classes; ++i) {
+    for (int j = i+1; j < num_classes; ++j) {
+      for (int k = 0; k < dim; ++k) {
+        w[k] = 0;
+      }
+      AddSVs(w, model, model->sv_coef[j-1], start[i], model->num_svs[i]);
+      AddSVs(w, model, model->sv_coef[i], start[j], model->num_svs[j]);
+      StoreWeights(model, p, w);
+      ++p;
+    }
+  }
+  delete[] start;
+  delete[] w;
+
+  return;
+}
+
+// w[p]^T x of a model with the linear kernel
+static double LinearValue(const SVMModel *model, int p, const Node *x) {
+  if (model->sparse_w != NULL) {
+    return Kernel::KernelFunction(x, model->sparse_w[p], model->param.kernel_param);
+  }
+  const double *w = model->w[p];
+  double sum = 0;
+  for (const Node *px = x; px->index != -1; ++px) {
+    if (px->index <= model->max_index) {
+      sum += w[px->index] * px->value;
+    }
+  }
+
+  return sum;
+}
+
 //
 // Interface functions
 //
 SVMModel *TrainSVM(const Problem *prob, const SVMParameter *param) {
+  return TrainSVM(prob, param, NULL);
+}
+
+SVMModel *TrainSVM(const Problem *prob, const SVMParameter *param, const SVMModel *init_model) {
+  return TrainSVM(prob, param, init_model, NULL);
+}
+
+// a temporary workspace is used if workspace is NULL
+SVMModel *TrainSVM(const Problem *prob, const SVMParameter *param, const SVMModel *init_model, SVMWorkspace *workspace) {
+  if (workspace == NULL) {
+    workspace = MakeSVMWorkspace();
+    SVMModel *model = TrainSVM(prob, param, init_model, workspace);
+    FreeSVMWorkspace(workspace);
+    return model;
+  }
+
   SVMModel *model = new SVMModel;
   model->param = *param;
 
@@ -1083,45 +2232,134 @@ SVMModel *TrainSVM(const Problem *prob, const SVMParameter *param) {
     non_zero[i] = false;
   }
 
+  // the binary subproblems are trained on num_threads threads, each thread has its own
+  // kernel cache of cache_size/num_threads, shared by the subproblems it trains,
+  // and the dense rows of dense data or the inverted index of sparse data are shared by all the threads,
+  // the threads left over (all of them for a single binary problem) are split evenly into worker pools,
+  // one for each of the num_threads threads, which run the loops over the examples inside the solver,
+  // the pools are only made if a subproblem is large enough for ParallelRange to split, and are kept in
+  // workspace for the next call, the linear SVCs work on the rows directly and need none of these,
+  // and C_SVC and OVA_SVC with an incremental workspace use the kernels and the subproblems kept in it
+  bool incremental = workspace->incremental && (param->svm_type == C_SVC || param->svm_type == OVA_SVC);
+  int num_tasks = (param->svm_type == OVA_SVC) ? num_classes : num_classes*(num_classes-1)/2;
+  int num_threads = std::max(1, std::min(GetNumThreads(param->num_threads), num_tasks));
+  int pool_threads = GetNumThreads(param->num_threads) / num_threads;
+  int max_sub_ex = num_ex;
+  if (param->svm_type != OVA_SVC) {
+    max_sub_ex = 0;
+    for (int i = 0; i < num_classes; ++i) {
+      for (int j = i+1; j < num_classes; ++j) {
+        max_sub_ex = std::max(max_sub_ex, count[i]+count[j]);
+      }
+    }
+  }
+  if (max_sub_ex < 2*kMinParallelRange) {
+    pool_threads = 1;
+  }
+  SVMParameter thread_param = *param;
+  thread_param.cache_size /= num_threads;
+  DenseRows *dense = NULL;
+  SparseIndex *sparse_index = NULL;
+  Kernel_Q **kernel_Q = new Kernel_Q*[num_threads];
+  while (workspace->threads.size() < static_cast<std::size_t>(num_threads)) {
+    workspace->threads.push_back(new SolverBuffers);
+    workspace->pools.push_back(NULL);
+  }
+  if (!IsLinearSVC(param->svm_type) && !incremental) {
+    dense = Kernel::MakeDenseRows(num_ex, x, param->kernel_param);
+    sparse_index = (dense == NULL) ? Kernel::MakeSparseIndex(num_ex, x, param->kernel_param) : NULL;
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    kernel_Q[i] = NULL;
+    if (!IsLinearSVC(param->svm_type) && !incremental) {
+      kernel_Q[i] = new Kernel_Q(num_ex, x, thread_param, num_classes, start, count, dense, sparse_index);
+      kernel_Q[i]->set_pool(GetPool(workspace, i, pool_threads));
+    }
+  }
+
+  // warm start is only for C_SVC and OVA_SVC, since the feasible set of NU_SVC changes with num_ex
+  int *init_sv = NULL;
+  int *init_class = NULL;
+  if (init_model != NULL && !incremental &&
+      init_model->param.svm_type == param->svm_type &&
+      param->svm_type != NU_SVC) {
+    init_sv = new int[num_ex];
+    init_class = new int[num_classes];
+    MapInitModel(init_model, num_ex, perm, num_classes, labels, init_sv, init_class);
+  }
+
   if (param->svm_type == C_SVC ||
-      param->svm_type == NU_SVC) {
+      param->svm_type == NU_SVC ||
+      IsLinearSVC(param->svm_type)) {
     // train k*(k-1)/2 models
     DecisionFunction *f = new DecisionFunction[num_classes*(num_classes-1)/2];
+    int *pair_i = new int[num_tasks];
+    int *pair_j = new int[num_tasks];
 
     int p = 0;
     for (int i = 0; i < num_classes; ++i) {
       for (int j = i+1; j < num_classes; ++j) {
+        pair_i[p] = i;
+        pair_j[p] = j;
+        ++p;
+      }
+    }
+
+    if (incremental) {
+      TrainIncremental(prob, param, num_classes, labels, start, count, perm, weighted_C, num_threads, pool_threads, f, workspace);
+    } else {
+      ParallelFor(num_tasks, num_threads, [&](int p, int thread) {
+        SolverBuffers *buffers = workspace->threads[static_cast<std::size_t>(thread)];
+        int i = pair_i[p], j = pair_j[p];
         Problem sub_prob;
         int si = start[i], sj = start[j];
         int ci = count[i], cj = count[j];
         sub_prob.num_ex = ci+cj;
-        sub_prob.x = new Node*[sub_prob.num_ex];
-        sub_prob.y = new double[sub_prob.num_ex];
+        sub_prob.x = buffers->sub_x.get(sub_prob.num_ex);
+        sub_prob.y = buffers->sub_y.get(sub_prob.num_ex);
+        int *index = buffers->sub_index.get(sub_prob.num_ex);
         for (int k = 0; k < ci; ++k) {
           sub_prob.x[k] = x[si+k];
           sub_prob.y[k] = +1;
+          index[k] = si+k;
         }
         for (int k = 0; k < cj; ++k) {
           sub_prob.x[ci+k] = x[sj+k];
           sub_prob.y[ci+k] = -1;
+          index[ci+k] = sj+k;
         }
 
-        f[p] = TrainSingleSVM(&sub_prob, param,weighted_C[i], weighted_C[j]);
-        for (int k = 0; k < ci; ++k) {
-          if (!non_zero[si+k] && fabs(f[p].alpha[k]) > 0) {
-            non_zero[si+k] = true;
+        double *init_alpha = NULL;
+        if (init_sv != NULL && init_class[i] != -1 && init_class[j] != -1) {
+          init_alpha = buffers->init_alpha.get(sub_prob.num_ex);
+          for (int k = 0; k < ci; ++k) {
+            init_alpha[k] = GetInitAlpha(init_model, init_sv[si+k], init_class[j]);
           }
-        }
-        for (int k = 0; k < cj; ++k) {
-          if (!non_zero[sj+k] && fabs(f[p].alpha[ci+k]) > 0) {
-            non_zero[sj+k] = true;
+          for (int k = 0; k < cj; ++k) {
+            init_alpha[ci+k] = GetInitAlpha(init_model, init_sv[sj+k], init_class[i]);
           }
         }
-        delete[] sub_prob.x;
-        delete[] sub_prob.y;
-        ++p;
+
+        f[p] = TrainSingleSVM(&sub_prob, param, index, kernel_Q[thread], weighted_C[i], weighted_C[j], init_alpha, buffers);
+      });
+    }
+
+    for (p = 0; p < num_tasks; ++p) {
+      int si = start[pair_i[p]], sj = start[pair_j[p]];
+      int ci = count[pair_i[p]], cj = count[pair_j[p]];
+      for (int k = 0; k < ci; ++k) {
+        if (!non_zero[si+k] && fabs(f[p].alpha[k]) > 0) {
+          non_zero[si+k] = true;
+        }
+      }
+      for (int k = 0; k < cj; ++k) {
+        if (!non_zero[sj+k] && fabs(f[p].alpha[ci+k]) > 0) {
+          non_zero[sj+k] = true;
+        }
       }
     }
+    delete[] pair_i;
+    delete[] pair_j;
 
     // build output
     model->num_classes = num_classes;
@@ -1215,34 +2453,52 @@ SVMModel *TrainSVM(const Problem *prob, const SVMParameter *param) {
     // train k models
     DecisionFunction *f = new DecisionFunction[num_classes];
 
+    if (incremental) {
+      TrainIncremental(prob, param, num_classes, labels, start, count, perm, weighted_C, num_threads, pool_threads, f, workspace);
+    } else {
+      ParallelFor(num_classes, num_threads, [&](int i, int thread) {
+        SolverBuffers *buffers = workspace->threads[static_cast<std::size_t>(thread)];
+        Problem sub_prob;
+        int si = start[i];
+        int ci = count[i];
+        sub_prob.num_ex = num_ex;
+        sub_prob.x = buffers->sub_x.get(sub_prob.num_ex);
+        sub_prob.y = buffers->sub_y.get(sub_prob.num_ex);
+        int *index = buffers->sub_index.get(sub_prob.num_ex);
+        for (int j = 0; j < si; ++j) {
+          sub_prob.x[j] = x[j];
+          sub_prob.y[j] = -1;
+        }
+        for (int j = 0; j < ci; ++j) {
+          sub_prob.x[si+j] = x[si+j];
+          sub_prob.y[si+j] = +1;
+        }
+        for (int j = si+ci; j < num_ex; ++j) {
+          sub_prob.x[j] = x[j];
+          sub_prob.y[j] = -1;
+        }
+        for (int j = 0; j < num_ex; ++j) {
+          index[j] = j;
+        }
+        double *init_alpha = NULL;
+        if (init_sv != NULL && init_class[i] != -1) {
+          init_alpha = buffers->init_alpha.get(sub_prob.num_ex);
+          for (int j = 0; j < num_ex; ++j) {
+            init_alpha[j] = GetInitAlpha(init_model, init_sv[j], init_class[i]);
+          }
+        }
+
+        double nega_weight = param->C * ci / (num_ex - ci);
+        f[i] = TrainSingleSVM(&sub_prob, param, index, kernel_Q[thread], weighted_C[i], nega_weight, init_alpha, buffers);
+      });
+    }
+
     for (int i = 0; i < num_classes; ++i) {
-      Problem sub_prob;
-      int si = start[i];
-      int ci = count[i];
-      sub_prob.num_ex = num_ex;
-      sub_prob.x = new Node*[sub_prob.num_ex];
-      sub_prob.y = new double[sub_prob.num_ex];
-      for (int j = 0; j < si; ++j) {
-        sub_prob.x[j] = x[j];
-        sub_prob.y[j] = -1;
-      }
-      for (int j = 0; j < ci; ++j) {
-        sub_prob.x[si+j] = x[si+j];
-        sub_prob.y[si+j] = +1;
-      }
-      for (int j = si+ci; j < num_ex; ++j) {
-        sub_prob.x[j] = x[j];
-        sub_prob.y[j] = -1;
-      }
-      double nega_weight = param->C * ci / (num_ex - ci);
-      f[i] = TrainSingleSVM(&sub_prob, param, weighted_C[i], nega_weight);
       for (int j = 0; j < num_ex; ++j) {
         if (!non_zero[j] && fabs(f[i].alpha[j]) > 0) {
           non_zero[j] = true;
         }
       }
-      delete[] sub_prob.x;
-      delete[] sub_prob.y;
     }
 
     // build output
@@ -1323,6 +2579,19 @@ SVMModel *TrainSVM(const Problem *prob, const SVMParameter *param) {
   delete[] x;
   delete[] weighted_C;
   delete[] non_zero;
+  for (int i = 0; i < num_threads; ++i) {
+    if (kernel_Q[i] != NULL) {
+      delete kernel_Q[i];
+    }
+  }
+  delete[] kernel_Q;
+  FreeDenseRows(dense);
+  FreeSparseIndex(sparse_index);
+  if (init_sv != NULL) {
+    delete[] init_sv;
+    delete[] init_class;
+  }
+  SetPredictor(model);
 
   return model;
 }
@@ -1332,13 +2601,16 @@ double PredictSVMValues(const SVMModel *model, const Node *x, double *decision_v
   int total_sv = model->total_sv;
   int best_idx = 0;
 
-  double *kvalue = new double[total_sv];
-  for (int i = 0; i < total_sv; ++i) {
-    kvalue[i] = Kernel::KernelFunction(x, model->svs[i], model->param.kernel_param);
+  // kvalue is NULL for the models folded into weight vectors
+  double *kvalue = NULL;
+  if (model->sv_kernel != NULL) {
+    kvalue = new double[total_sv];
+    model->sv_kernel->KernelValues(x, kvalue);
   }
 
   if (model->param.svm_type == C_SVC ||
-      model->param.svm_type == NU_SVC) {
+      model->param.svm_type == NU_SVC ||
+      IsLinearSVC(model->param.svm_type)) {
     int *start = new int[num_classes];
     start[0] = 0;
     for (int i = 1; i < num_classes; ++i) {
@@ -1354,18 +2626,22 @@ double PredictSVMValues(const SVMModel *model, const Node *x, double *decision_v
     for (int i = 0; i < num_classes; ++i) {
       for (int j = i+1; j < num_classes; ++j) {
         double sum = 0;
-        int si = start[i];
-        int sj = start[j];
-        int ci = model->num_svs[i];
-        int cj = model->num_svs[j];
-
-        double *coef1 = model->sv_coef[j-1];
-        double *coef2 = model->sv_coef[i];
-        for (int k = 0; k < ci; ++k) {
-          sum += coef1[si+k] * kvalue[si+k];
-        }
-        for (int k = 0; k < cj; ++k) {
-          sum += coef2[sj+k] * kvalue[sj+k];
+        if (kvalue == NULL) {
+          sum = LinearValue(model, p, x);
+        } else {
+          int si = start[i];
+          int sj = start[j];
+          int ci = model->num_svs[i];
+          int cj = model->num_svs[j];
+
+          double *coef1 = model->sv_coef[j-1];
+          double *coef2 = model->sv_coef[i];
+          for (int k = 0; k < ci; ++k) {
+            sum += coef1[si+k] * kvalue[si+k];
+          }
+          for (int k = 0; k < cj; ++k) {
+            sum += coef2[sj+k] * kvalue[sj+k];
+          }
         }
         sum -= model->rho[p];
         decision_values[p] = sum;
@@ -1393,9 +2669,13 @@ double PredictSVMValues(const SVMModel *model, const Node *x, double *decision_v
     double max_decision_value = -kInf;
     for (int i = 0; i < num_classes; ++i) {
       double sum = 0;
-      double *coef = model->sv_coef[i];
-      for (int j = 0; j < total_sv; ++j) {
-        sum += coef[j] * kvalue[j];
+      if (kvalue == NULL) {
+        sum = LinearValue(model, i, x);
+      } else {
+        double *coef = model->sv_coef[i];
+        for (int j = 0; j < total_sv; ++j) {
+          sum += coef[j] * kvalue[j];
+        }
       }
       sum -= model->rho[i];
       decision_values[i] = sum;
@@ -1407,7 +2687,9 @@ double PredictSVMValues(const SVMModel *model, const Node *x, double *decision_v
     }
   }
 
-  delete[] kvalue;
+  if (kvalue != NULL) {
+    delete[] kvalue;
+  }
 
   return model->labels[best_idx];
 }
@@ -1425,7 +2707,7 @@ double PredictSVM(const SVMModel *model, const Node *x) {
   return pred_result;
 }
 
-static const char *kSVMTypeTable[] = { "c_svc", "nu_svc", "ovs_svc", NULL };
+static const char *kSVMTypeTable[] = { "c_svc", "nu_svc", "ovs_svc", "l1_linear_svc", "l2_linear_svc", NULL };
 
 static const char *kKernelTypeTable[] = { "linear", "polynomial", "rbf", "sigmoid", "precomputed", NULL };
 
@@ -1465,7 +2747,8 @@ int SaveSVMModel(std::ofstream &model_file, const struct SVMModel *model) {
   if (model->rho) {
     model_file << "rho";
     if (param.svm_type == C_SVC ||
-        param.svm_type == NU_SVC) {
+        param.svm_type == NU_SVC ||
+        IsLinearSVC(param.svm_type)) {
       for (int i = 0; i < num_classes*(num_classes-1)/2; ++i)
         model_file << ' ' << model->rho[i];
     } else if (param.svm_type == OVA_SVC) {
@@ -1521,10 +2804,14 @@ SVMModel *LoadSVMModel(std::ifstream &model_file) {
   SVMModel *model = new SVMModel;
   SVMParameter &param = model->param;
   param.kernel_param = new KernelParameter;
+  param.num_threads = 1;
   model->rho = NULL;
   model->sv_indices = NULL;
   model->labels = NULL;
   model->num_svs = NULL;
+  model->sv_kernel = NULL;
+  model->w = NULL;
+  model->sparse_w = NULL;
 
   char cmd[80];
   while (1) {
@@ -1586,7 +2873,8 @@ SVMModel *LoadSVMModel(std::ifstream &model_file) {
     if (std::strcmp(cmd, "rho") == 0) {
       int n;
       if (param.svm_type == C_SVC ||
-          param.svm_type == NU_SVC) {
+          param.svm_type == NU_SVC ||
+          IsLinearSVC(param.svm_type)) {
         n = model->num_classes*(model->num_classes-1)/2;
       } else {
         n = model->num_classes;
@@ -1613,7 +2901,8 @@ SVMModel *LoadSVMModel(std::ifstream &model_file) {
     if (std::strcmp(cmd, "SVs") == 0) {
       std::size_t m;
       if (param.svm_type == C_SVC ||
-          param.svm_type == NU_SVC) {
+          param.svm_type == NU_SVC ||
+          IsLinearSVC(param.svm_type)) {
         m = static_cast<size_t>(model->num_classes)-1;
       } else {
         m = static_cast<size_t>(model->num_classes);
@@ -1707,6 +2996,8 @@ SVMModel *LoadSVMModel(std::ifstream &model_file) {
       return NULL;
     }
   }
+  SetPredictor(model);
+
   return model;
 }
 
@@ -1728,6 +3019,28 @@ void FreeSVMModel(SVMModel* model)
     model->svs = NULL;
   }
 
+  if (model->sv_kernel != NULL) {
+    delete model->sv_kernel;
+    model->sv_kernel = NULL;
+  }
+
+  int num_functions = (model->param.svm_type == OVA_SVC) ? model->num_classes : model->num_classes*(model->num_classes-1)/2;
+  if (model->w != NULL) {
+    for (int i = 0; i < num_functions; ++i) {
+      delete[] model->w[i];
+    }
+    delete[] model->w;
+    model->w = NULL;
+  }
+
+  if (model->sparse_w != NULL) {
+    for (int i = 0; i < num_functions; ++i) {
+      delete[] model->sparse_w[i];
+    }
+    delete[] model->sparse_w;
+    model->sparse_w = NULL;
+  }
+
   if (model->rho != NULL) {
     delete[] model->rho;
     model->rho = NULL;
@@ -1788,9 +3101,14 @@ const char *CheckSVMParameter(const SVMParameter *param) {
   int svm_type = param->svm_type;
   if (svm_type != C_SVC &&
       svm_type != NU_SVC &&
-      svm_type != OVA_SVC)
+      svm_type != OVA_SVC &&
+      !IsLinearSVC(svm_type))
     return "unknown svm type";
 
+  if (IsLinearSVC(svm_type) &&
+      param->kernel_param->kernel_type != LINEAR)
+    return "linear SVC only supports the linear kernel";
+
   if (param->cache_size <= 0)
     return "cache_size <= 0";
 
@@ -1798,7 +3116,8 @@ const char *CheckSVMParameter(const SVMParameter *param) {
     return "eps <= 0";
 
   if (svm_type == C_SVC ||
-      svm_type == OVA_SVC)
+      svm_type == OVA_SVC ||
+      IsLinearSVC(svm_type))
     if (param->C <= 0)
       return "C <= 0";
 
@@ -1810,6 +3129,9 @@ const char *CheckSVMParameter(const SVMParameter *param) {
       param->shrinking != 1)
     return "shrinking != 0 and shrinking != 1";
 
+  if (param->num_threads < 0)
+    return "num_threads < 0";
+
   return NULL;
 }
 
@@ -1822,6 +3144,7 @@ void InitSVMParam(struct SVMParameter *param) {
   param->C = 1;
   param->eps = 1e-3;
   param->shrinking = 1;
+  param->num_threads = 1;
   param->num_weights = 0;
   param->weight_labels = NULL;
   param->weights = NULL;
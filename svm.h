@@ -4,19 +4,20 @@
 #include "utilities.h"
 #include "kernel.h"
 
-enum { C_SVC, NU_SVC, OVA_SVC };  // svm_type
+enum { C_SVC, NU_SVC, OVA_SVC, L1_LINEAR_SVC, L2_LINEAR_SVC };  // svm_type
 
 struct SVMParameter {
   struct KernelParameter *kernel_param;
   int svm_type;
   double cache_size; // in MB
   double eps;  // stopping criteria
-  double C;  // for C_SVC and OVA_SVC
-  int num_weights;  // for C_SVC and OVA_SVC
-  int *weight_labels;  // for C_SVC and OVA_SVC
-  double *weights;  // for C_SVC and OVA_SVC
+  double C;  // for C_SVC, OVA_SVC and the linear SVCs
+  int num_weights;  // for C_SVC, OVA_SVC and the linear SVCs
+  int *weight_labels;  // for C_SVC, OVA_SVC and the linear SVCs
+  double *weights;  // for C_SVC, OVA_SVC and the linear SVCs
   double nu;  // for NU_SVC
   int shrinking;  // use the shrinking heuristics
+  int num_threads;  // for training the binary subproblems and the loops inside each of them, 0 for all cores
 };
 
 struct SVMModel {
@@ -31,9 +32,18 @@ struct SVMModel {
   int *labels;  // label of each class (label[k])
   int *num_svs;  // number of SVs for each class (nSV[k])
                  // nSV[0] + nSV[1] + ... + nSV[k-1] = total_sv
+  SVKernel *sv_kernel;  // kernel values with the SVs for prediction, NULL for the linear kernel
+  double **w;  // dense weight vectors of the decision functions for the linear kernel (w[p][0,...,max_index]), NULL otherwise
+  struct Node **sparse_w;  // sparse weight vectors instead of w when most features up to max_index are unused, NULL otherwise
+  int max_index;  // largest feature index of the SVs
 };
 
+struct SVMWorkspace;  // arrays of the solvers, kept for the subproblems of later calls of TrainSVM
+                      // (and the subproblems themselves when it is incremental)
+
 SVMModel *TrainSVM(const struct Problem *prob, const struct SVMParameter *param);
+SVMModel *TrainSVM(const struct Problem *prob, const struct SVMParameter *param, const struct SVMModel *init_model);
+SVMModel *TrainSVM(const struct Problem *prob, const struct SVMParameter *param, const struct SVMModel *init_model, struct SVMWorkspace *workspace);
 double PredictSVMValues(const struct SVMModel *model, const struct Node *x, double *decision_values);
 double PredictSVM(const struct SVMModel *model, const struct Node *x);
 
@@ -41,6 +51,10 @@ int SaveSVMModel(std::ofstream &model_file, const struct SVMModel *model);
 SVMModel *LoadSVMModel(std::ifstream &model_file);
 void FreeSVMModel(struct SVMModel *model);
 
+SVMWorkspace *MakeSVMWorkspace();
+SVMWorkspace *MakeSVMWorkspace(bool incremental);
+void FreeSVMWorkspace(struct SVMWorkspace *workspace);
+
 void FreeSVMParam(struct SVMParameter *param);
 void InitSVMParam(struct SVMParameter *param);
 const char *CheckSVMParameter(const struct SVMParameter *param);
@@ -4,7 +4,20 @@
 #include <string>
 #include <vector>
 #include <cmath>
-#include <exception>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(LIBVM_DENSE_LANES) && (defined(__AVX2__) || defined(__AVX512F__))
+#include <immintrin.h>
+#endif
 
 void (*PrintString) (const char *) = &PrintNull;
 
@@ -32,123 +45,513 @@ void SetPrintCout() {
   PrintString = &PrintCout;
 }
 
-Problem *ReadProblem(const char *file_name) {
-  std::ifstream input_file(file_name);
-  if (!input_file.is_open()) {
-    std::cerr << "Unable to open input file: " << file_name << std::endl;
-    exit(EXIT_FAILURE);
+// num_threads <= 0 means one thread per hardware core
+int GetNumThreads(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = static_cast<int>(std::thread::hardware_concurrency());
+  }
+  if (num_threads <= 0) {
+    num_threads = 1;
   }
 
-  int max_index, current_max_index;
-  std::string line;
-  Problem *problem = new Problem;
-  problem->num_ex = 0;
+  return num_threads;
+}
+
+// run task(t, thread_id) for t in [0,num_tasks), tasks are handed out to the threads in order
+void ParallelFor(int num_tasks, int num_threads, const std::function<void(int, int)> &task) {
+  num_threads = std::min(GetNumThreads(num_threads), num_tasks);
 
-  while (std::getline(input_file, line)) {
-    ++problem->num_ex;
+  if (num_threads <= 1) {
+    for (int t = 0; t < num_tasks; ++t) {
+      task(t, 0);
+    }
+    return;
   }
-  input_file.clear();
-  input_file.seekg(0);
 
-  problem->y = new double[problem->num_ex];
-  problem->x = new Node*[problem->num_ex];
+  std::atomic<int> next_task(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.push_back(std::thread([&task, &next_task, num_tasks, i]() {
+      for (int t = next_task++; t < num_tasks; t = next_task++) {
+        task(t, i);
+      }
+    }));
+  }
+  for (std::size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
 
-  max_index = 0;
-  for (int i = 0; i < problem->num_ex; ++i) {
-    std::vector<std::string> tokens;
-    std::size_t prev = 0, pos;
-
-    current_max_index = -1;
-    std::getline(input_file, line);
-    while ((pos = line.find_first_of(" \t\n\r", prev)) != std::string::npos) {
-      if (pos > prev) {
-        tokens.push_back(line.substr(prev, pos-prev));
+  return;
+}
+
+WorkerPool::WorkerPool(int num_threads)
+    : num_threads_(std::max(1, num_threads)), task_(NULL), generation_(0), pending_(0), stop_(false), num_parked_(0) {
+  for (int i = 1; i < num_threads_; ++i) {
+    workers_.push_back(std::thread(&WorkerPool::Work, this, i));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  stop_.store(true);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    generation_.fetch_add(1);
+  }
+  task_ready_.notify_all();
+  for (std::size_t i = 0; i < workers_.size(); ++i) {
+    workers_[i].join();
+  }
+}
+
+// the threads spin for a while before they park on a condition variable, so that the barrier is cheap when
+// the tasks come in quick succession, and idle threads do not hold their cores during the serial parts;
+// num_parked_ is raised before the last check of the condition and read after the condition changes
+// (both sequentially consistent), so the side that changes it notifies whenever a thread may be parked
+static const int kSpinsBeforePark = 1 << 12;
+
+void WorkerPool::Run(const std::function<void(int)> &task) {
+  task_ = &task;
+  pending_.store(num_threads_-1);
+  generation_.fetch_add(1);
+  if (num_parked_.load() > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ready_.notify_all();
+  }
+  task(0);
+  for (int spins = 0; pending_.load(std::memory_order_acquire) != 0; ++spins) {
+    if (spins >= kSpinsBeforePark) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      num_parked_.fetch_add(1);
+      task_done_.wait(lock, [this] { return pending_.load() == 0; });
+      num_parked_.fetch_sub(1);
+      break;
+    }
+  }
+
+  return;
+}
+
+void WorkerPool::Work(int thread) {
+  unsigned seen = 0;
+  while (true) {
+    unsigned generation;
+    for (int spins = 0; (generation = generation_.load(std::memory_order_acquire)) == seen; ++spins) {
+      if (spins >= kSpinsBeforePark) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        num_parked_.fetch_add(1);
+        task_ready_.wait(lock, [this, seen] { return generation_.load() != seen; });
+        num_parked_.fetch_sub(1);
       }
-      prev = pos + 1;
     }
-    if (prev < line.length()) {
-      tokens.push_back(line.substr(prev, std::string::npos));
+    seen = generation;
+    if (stop_.load()) {
+      return;
+    }
+    (*task_)(thread);
+    if (pending_.fetch_sub(1) == 1 && num_parked_.load() > 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_done_.notify_all();
     }
+  }
+}
+
+static inline bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// parse the whole token [begin,end) into value, returns the reason of failure or NULL
+template <typename T>
+static const char *ParseToken(const char *begin, const char *end, T &value) {
+  if (end - begin > 1 && *begin == '+' && begin[1] != '-') {
+    ++begin;  // std::from_chars does not accept a leading '+' as std::stod does
+  }
+  std::from_chars_result result = std::from_chars(begin, end, value);
+  if (result.ec == std::errc::result_out_of_range) {
+    return "out of range";
+  }
+  if (result.ec != std::errc()) {
+    return "invalid number";
+  }
+  if (result.ptr != end) {
+    return "incomplete convention";
+  }
+
+  return NULL;
+}
+
+// a chunk of the file, made of whole lines, that is parsed by one thread
+struct ParseChunk {
+  const char *begin;
+  const char *end;
+  int first_line;  // index of the first line of the chunk in the file
+  int num_lines;
+  std::size_t first_node;  // offset of the nodes of the chunk in the pool
+  std::size_t num_nodes;
+  int max_index;
+  int error_line;  // -1 if the chunk is parsed without errors
+  const char *error;
+  std::string error_token;
+};
+
+// chunks smaller than this are not worth a thread of their own
+static const std::size_t kMinParseChunkSize = 1 << 20;
+
+// every feature token has a ':', so this bounds the number of nodes of all the rows
+static void CountChunk(ParseChunk &chunk) {
+  chunk.num_lines = static_cast<int>(std::count(chunk.begin, chunk.end, '\n'));
+  if (chunk.end > chunk.begin && chunk.end[-1] != '\n') {
+    ++chunk.num_lines;
+  }
+  chunk.num_nodes = static_cast<std::size_t>(std::count(chunk.begin, chunk.end, ':')) + static_cast<std::size_t>(chunk.num_lines);
+
+  return;
+}
 
-    try
-    {
-      std::size_t end;
+// parse the line [line,line_end) into y and the nodes x, which must have room for the ':' of the line plus one,
+// returns the reason of failure and the failing token in [token,token_end), or NULL
+static const char *ParseLine(const char *line, const char *line_end, double &y, Node *x, std::size_t &num_nodes,
+                             int &max_index, const char *&token, const char *&token_end) {
+  const char *error = NULL;
+  std::size_t j = 0;
+
+  token = line;
+  for ( ; token < line_end && IsSpace(*token); ++token) {}
+  for (token_end = token; token_end < line_end && !IsSpace(*token_end); ++token_end) {}
+
+  if (token == token_end) {
+    error = "empty line";
+  } else {
+    error = ParseToken(token, token_end, y);
+  }
 
-      problem->y[i] = std::stod(tokens[0], &end);
-      if (end != tokens[0].length()) {
-        throw std::invalid_argument("incomplete convention");
+  max_index = -1;
+  while (error == NULL) {
+    for (token = token_end; token < line_end && IsSpace(*token); ++token) {}
+    if (token == line_end) {
+      break;
+    }
+    for (token_end = token; token_end < line_end && !IsSpace(*token_end); ++token_end) {}
+
+    const char *colon = static_cast<const char *>(std::memchr(token, ':', static_cast<std::size_t>(token_end-token)));
+    if (colon == NULL) {
+      error = "incomplete convention";
+      break;
+    }
+    error = ParseToken(token, colon, x[j].index);
+    if (error == NULL) {
+      error = ParseToken(colon+1, token_end, x[j].value);
+    }
+    max_index = x[j].index;
+    ++j;
+  }
+
+  x[j].index = -1;
+  x[j].value = 0;
+  num_nodes = j + 1;
+
+  return error;
+}
+
+static void ParseChunkLines(ParseChunk &chunk, Problem *problem) {
+  std::size_t offset = chunk.first_node;
+  const char *line = chunk.begin;
+
+  chunk.max_index = 0;
+  chunk.error_line = -1;
+  for (int i = chunk.first_line; i < chunk.first_line + chunk.num_lines; ++i) {
+    const char *line_end = static_cast<const char *>(std::memchr(line, '\n', static_cast<std::size_t>(chunk.end-line)));
+    if (line_end == NULL) {
+      line_end = chunk.end;
+    }
+
+    const char *token, *token_end;
+    std::size_t num_nodes;
+    int current_max_index;
+    problem->x[i] = problem->nodes + offset;
+    const char *error = ParseLine(line, line_end, problem->y[i], problem->x[i], num_nodes, current_max_index, token, token_end);
+
+    if (error != NULL) {
+      chunk.error_line = i;
+      chunk.error = error;
+      chunk.error_token.assign(token, token_end);
+      return;
+    }
+
+    if (current_max_index > chunk.max_index) {
+      chunk.max_index = current_max_index;
+    }
+    offset += num_nodes;
+    line = line_end + 1;
+  }
+
+  return;
+}
+
+// binary data file: a header, the labels y[num_ex], the row offsets[num_ex+1] and the nodes of all the rows,
+// every section starts at a multiple of 8 bytes and a node is stored as int32 index, 4 bytes padding and float64 value
+struct BinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endian_tag;  // kBinaryEndianTag in the byte order of the machine that wrote the file
+  int32_t num_ex;
+  int32_t max_index;
+  uint64_t num_nodes;
+};
+
+static const char kBinaryMagic[8] = {'L', 'I', 'B', 'V', 'M', 'B', 'I', 'N'};
+static const uint32_t kBinaryVersion = 1;
+static const uint32_t kBinaryEndianTag = 0x01020304;
+static const std::size_t kBinaryNodeSize = 16;
+
+template <typename T>
+static inline T SwapBytes(T value) {
+  char *bytes = reinterpret_cast<char *>(&value);
+  std::reverse(bytes, bytes+sizeof(T));
+  return value;
+}
+
+// the labels and nodes are used in place when the file has the byte order and node layout of this machine,
+// otherwise they are converted into allocated arrays
+static Problem *MapBinaryProblem(const char *file_name, char *data, std::size_t size) {
+  BinaryHeader header;
+  const char *error = NULL;
+  bool swap = false;
+
+  if (size < sizeof(header)) {
+    error = "truncated header";
+  } else {
+    std::memcpy(&header, data, sizeof(header));
+    swap = (header.endian_tag != kBinaryEndianTag);
+    if (swap) {
+      header.version = SwapBytes(header.version);
+      header.endian_tag = SwapBytes(header.endian_tag);
+      header.num_ex = SwapBytes(header.num_ex);
+      header.max_index = SwapBytes(header.max_index);
+      header.num_nodes = SwapBytes(header.num_nodes);
+    }
+    if (header.endian_tag != kBinaryEndianTag) {
+      error = "unknown byte order";
+    } else if (header.version != kBinaryVersion) {
+      error = "unsupported version";
+    } else if (header.num_ex < 0 || header.num_nodes > (size - sizeof(header)) / kBinaryNodeSize ||
+               sizeof(header) + 8 * (2 * static_cast<uint64_t>(header.num_ex) + 1) + kBinaryNodeSize * header.num_nodes > size) {
+      error = "truncated data";
+    }
+  }
+
+  if (error != NULL) {
+    std::cerr << "Error: " << error << " in binary data file " << file_name << std::endl;
+    munmap(data, size);
+    exit(EXIT_FAILURE);
+  }
+
+  std::size_t num_ex = static_cast<std::size_t>(header.num_ex);
+  std::size_t num_nodes = static_cast<std::size_t>(header.num_nodes);
+  char *y = data + sizeof(header);
+  const char *offsets = y + 8 * num_ex;
+  char *nodes = data + sizeof(header) + 8 * (2 * num_ex + 1);
+
+  Problem *problem = new Problem;
+  problem->num_ex = header.num_ex;
+  problem->max_index = header.max_index;
+  problem->x = new Node*[num_ex];
+
+  if (!swap && sizeof(Node) == kBinaryNodeSize && offsetof(Node, value) == 8) {
+    problem->y = reinterpret_cast<double *>(y);
+    problem->nodes = reinterpret_cast<Node *>(nodes);
+    problem->mapped = data;
+    problem->mapped_size = size;
+  } else {
+    problem->y = new double[num_ex];
+    problem->nodes = new Node[num_nodes];
+    problem->mapped = NULL;
+    problem->mapped_size = 0;
+    for (std::size_t i = 0; i < num_ex; ++i) {
+      std::memcpy(&problem->y[i], y + 8 * i, 8);
+      if (swap) {
+        problem->y[i] = SwapBytes(problem->y[i]);
       }
     }
-    catch(std::exception& e)
-    {
-      std::cerr << "Error: " << e.what() << " in line " << (i+1) << " tokens " << tokens[0] << std::endl;
-      delete[] problem->y;
-      for (int j = 0; j < i; ++j) {
-        delete[] problem->x[j];
+    for (std::size_t i = 0; i < num_nodes; ++i) {
+      int32_t index;
+      std::memcpy(&index, nodes + kBinaryNodeSize * i, 4);
+      std::memcpy(&problem->nodes[i].value, nodes + kBinaryNodeSize * i + 8, 8);
+      if (swap) {
+        index = SwapBytes(index);
+        problem->nodes[i].value = SwapBytes(problem->nodes[i].value);
       }
-      delete[] problem->x;
-      delete problem;
-      std::vector<std::string>(tokens).swap(tokens);
-      input_file.close();
-      exit(EXIT_FAILURE);
-    }  // TODO try not to use exception
-
-    std::size_t elements = tokens.size();
-    problem->x[i] = new Node[elements];
-    prev = 0;
-    for (std::size_t j = 0; j < elements-1; ++j) {
-      pos = tokens[j+1].find_first_of(':');
-      try
-      {
-        std::size_t end;
-        problem->x[i][j].index = std::stoi(tokens[j+1].substr(prev, pos-prev), &end);
-        if (end != (tokens[j+1].substr(prev, pos-prev)).length()) {
-          throw std::invalid_argument("incomplete convention");
-        }
-        problem->x[i][j].value = std::stod(tokens[j+1].substr(pos+1), &end);
-        if (end != (tokens[j+1].substr(pos+1)).length()) {
-          throw std::invalid_argument("incomplete convention");
-        }
+      problem->nodes[i].index = index;
+    }
+  }
+
+  // every row holds at least its terminator, ends with index -1 and has its feature indices in [1, max_index]
+  uint64_t begin = 0, end;
+  for (std::size_t i = 0; i <= num_ex; ++i) {
+    std::memcpy(&end, offsets + 8 * i, 8);
+    if (swap) {
+      end = SwapBytes(end);
+    }
+    if (i == 0) {
+      if (end != 0) {
+        error = "invalid row offset";
       }
-      catch(std::exception& e)
-      {
-        std::cerr << "Error: " << e.what() << " in line " << (i+1) << " tokens " << tokens[j+1] << std::endl;
-        delete[] problem->y;
-        for (int j = 0; j < i+1; ++j) {
-          delete[] problem->x[j];
+    } else if (end <= begin || end > num_nodes) {
+      error = "invalid row offset";
+    } else if (problem->nodes[end-1].index != -1) {
+      error = "unterminated row";
+    } else {
+      for (uint64_t j = begin; j < end-1; ++j) {
+        if (problem->nodes[j].index < 1 || problem->nodes[j].index > header.max_index) {
+          error = "feature index out of range";
+          break;
         }
-        delete[] problem->x;
-        delete problem;
-        std::vector<std::string>(tokens).swap(tokens);
-        input_file.close();
-        exit(EXIT_FAILURE);
       }
-      current_max_index = problem->x[i][j].index;
     }
+    if (error != NULL) {
+      std::cerr << "Error: " << error << " at row offset " << i << " of binary data file " << file_name << std::endl;
+      if (problem->mapped == NULL) {
+        munmap(data, size);
+      }
+      FreeProblem(problem);
+      exit(EXIT_FAILURE);
+    }
+    if (i < num_ex) {
+      problem->x[i] = problem->nodes + end;
+    }
+    begin = end;
+  }
 
-    if (current_max_index > max_index) {
-      max_index = current_max_index;
+  if (problem->mapped == NULL) {
+    munmap(data, size);
+  }
+
+  return problem;
+}
+
+Problem *ReadProblem(const char *file_name) {
+  return ReadProblem(file_name, 1);
+}
+
+// the file is mapped into memory and split into chunks at line boundaries, the lines and nodes of every chunk
+// are counted first so that each chunk is parsed in place into its own part of one pool of nodes
+Problem *ReadProblem(const char *file_name, int num_threads) {
+  int fd = open(file_name, O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    std::cerr << "Unable to open input file: " << file_name << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  std::size_t size = static_cast<std::size_t>(file_stat.st_size);
+  const char *data = NULL;
+  if (size > 0) {
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      std::cerr << "Unable to map input file: " << file_name << std::endl;
+      close(fd);
+      exit(EXIT_FAILURE);
+    }
+    madvise(addr, size, MADV_SEQUENTIAL);
+    data = static_cast<const char *>(addr);
+  }
+  close(fd);
+  const char *end = data + size;
+
+  if (size >= sizeof(kBinaryMagic) && std::memcmp(data, kBinaryMagic, sizeof(kBinaryMagic)) == 0) {
+    return MapBinaryProblem(file_name, const_cast<char *>(data), size);
+  }
+
+  num_threads = GetNumThreads(num_threads);
+  std::size_t num_chunks = std::max<std::size_t>(1, std::min(static_cast<std::size_t>(num_threads), size / kMinParseChunkSize));
+  std::vector<ParseChunk> chunks(num_chunks);
+  const char *begin = data;
+  for (std::size_t c = 0; c < num_chunks; ++c) {
+    const char *chunk_end = end;
+    if (c + 1 < num_chunks) {
+      chunk_end = data + size / num_chunks * (c+1);
+      if (chunk_end < begin) {
+        chunk_end = begin;
+      }
+      chunk_end = static_cast<const char *>(std::memchr(chunk_end, '\n', static_cast<std::size_t>(end-chunk_end)));
+      chunk_end = (chunk_end == NULL) ? end : chunk_end + 1;
+    }
+    chunks[c].begin = begin;
+    chunks[c].end = chunk_end;
+    begin = chunk_end;
+  }
+
+  ParallelFor(static_cast<int>(num_chunks), num_threads, [&](int c, int) {
+    CountChunk(chunks[static_cast<std::size_t>(c)]);
+  });
+
+  Problem *problem = new Problem;
+  std::size_t num_nodes = 0;
+  problem->num_ex = 0;
+  problem->mapped = NULL;
+  problem->mapped_size = 0;
+  for (std::size_t c = 0; c < num_chunks; ++c) {
+    chunks[c].first_line = problem->num_ex;
+    chunks[c].first_node = num_nodes;
+    problem->num_ex += chunks[c].num_lines;
+    num_nodes += chunks[c].num_nodes;
+  }
+
+  problem->y = new double[problem->num_ex];
+  problem->x = new Node*[problem->num_ex];
+  problem->nodes = new Node[num_nodes];
+  for (int i = 0; i < problem->num_ex; ++i) {
+    problem->x[i] = NULL;
+  }
+
+  ParallelFor(static_cast<int>(num_chunks), num_threads, [&](int c, int) {
+    ParseChunkLines(chunks[static_cast<std::size_t>(c)], problem);
+  });
+
+  // the first error of the file is reported, as the chunks before it are parsed without errors
+  int max_index = 0;
+  for (std::size_t c = 0; c < num_chunks; ++c) {
+    if (chunks[c].error_line != -1) {
+      std::cerr << "Error: " << chunks[c].error << " in line " << (chunks[c].error_line+1) << " tokens " << chunks[c].error_token << std::endl;
+      FreeProblem(problem);
+      if (data != NULL) {
+        munmap(const_cast<char *>(data), size);
+      }
+      exit(EXIT_FAILURE);
+    }
+    if (chunks[c].max_index > max_index) {
+      max_index = chunks[c].max_index;
     }
-    problem->x[i][elements-1].index = -1;
-    problem->x[i][elements-1].value = 0;
   }
   problem->max_index = max_index;
 
   // TODO add precomputed kernel check
 
-  input_file.close();
+  if (data != NULL) {
+    munmap(const_cast<char *>(data), size);
+  }
 
   return problem;
 }
 
 void FreeProblem(struct Problem *problem) {
+  if (problem->mapped != NULL) {
+    delete[] problem->x;
+    munmap(problem->mapped, problem->mapped_size);
+    delete problem;
+    return;
+  }
+
   if (problem->y != NULL) {
     delete[] problem->y;
   }
 
-  for (int i = 0; i < problem->num_ex; ++i) {
-    if (problem->x[i] != NULL) {
-      delete[] problem->x[i];
+  if (problem->nodes != NULL) {
+    delete[] problem->nodes;
+  } else {
+    for (int i = 0; i < problem->num_ex; ++i) {
+      if (problem->x[i] != NULL) {
+        delete[] problem->x[i];
+      }
     }
   }
   if (problem->x != NULL) {
@@ -161,6 +564,114 @@ void FreeProblem(struct Problem *problem) {
   return;
 }
 
+// read at most max_num_ex lines of data from input, num_lines counts the lines read so far for error messages
+Problem *ReadProblem(std::istream &input, int max_num_ex, int *num_lines) {
+  std::string line;
+  std::vector<double> y;
+  std::vector<std::size_t> offsets;
+  std::vector<Node> nodes;
+  int max_index = 0;
+
+  while (static_cast<int>(y.size()) < max_num_ex && std::getline(input, line)) {
+    const char *begin = line.data(), *end = line.data() + line.size();
+    const char *token, *token_end;
+    std::size_t num_nodes;
+    int current_max_index;
+    double label;
+
+    // a binary data file is laid out for mapping as a whole, its rows cannot be read in batches
+    if (*num_lines == 0 && line.size() >= sizeof(kBinaryMagic) &&
+        std::memcmp(line.data(), kBinaryMagic, sizeof(kBinaryMagic)) == 0) {
+      std::cerr << "Error: binary data files cannot be read as a stream, give the file name without -r" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    ++*num_lines;
+    offsets.push_back(nodes.size());
+    nodes.resize(nodes.size() + static_cast<std::size_t>(std::count(begin, end, ':')) + 1);
+    const char *error = ParseLine(begin, end, label, &nodes[offsets.back()], num_nodes, current_max_index, token, token_end);
+
+    if (error != NULL) {
+      std::cerr << "Error: " << error << " in line " << *num_lines << " tokens " << std::string(token, token_end) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    y.push_back(label);
+    nodes.resize(offsets.back() + num_nodes);
+    if (current_max_index > max_index) {
+      max_index = current_max_index;
+    }
+  }
+
+  if (y.empty()) {
+    return NULL;
+  }
+
+  Problem *problem = new Problem;
+  problem->num_ex = static_cast<int>(y.size());
+  problem->max_index = max_index;
+  problem->y = new double[y.size()];
+  problem->x = new Node*[y.size()];
+  problem->nodes = new Node[nodes.size()];
+  problem->mapped = NULL;
+  problem->mapped_size = 0;
+  std::copy(y.begin(), y.end(), problem->y);
+  std::copy(nodes.begin(), nodes.end(), problem->nodes);
+  for (std::size_t i = 0; i < y.size(); ++i) {
+    problem->x[i] = problem->nodes + offsets[i];
+  }
+
+  return problem;
+}
+
+int SaveProblem(const char *file_name, const struct Problem *problem) {
+  std::ofstream output_file(file_name, std::ios::binary);
+  if (!output_file.is_open()) {
+    std::cerr << "Unable to open output file: " << file_name << std::endl;
+    return -1;
+  }
+
+  std::size_t num_ex = static_cast<std::size_t>(problem->num_ex);
+  std::vector<uint64_t> offsets(num_ex+1, 0);
+  for (std::size_t i = 0; i < num_ex; ++i) {
+    uint64_t length = 1;
+    for (const Node *x = problem->x[i]; x->index != -1; ++x) {
+      ++length;
+    }
+    offsets[i+1] = offsets[i] + length;
+  }
+
+  BinaryHeader header;
+  std::memcpy(header.magic, kBinaryMagic, sizeof(kBinaryMagic));
+  header.version = kBinaryVersion;
+  header.endian_tag = kBinaryEndianTag;
+  header.num_ex = problem->num_ex;
+  header.max_index = problem->max_index;
+  header.num_nodes = offsets[num_ex];
+
+  output_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  output_file.write(reinterpret_cast<const char *>(problem->y), static_cast<std::streamsize>(sizeof(double) * num_ex));
+  output_file.write(reinterpret_cast<const char *>(offsets.data()), static_cast<std::streamsize>(sizeof(uint64_t) * (num_ex+1)));
+
+  char record[kBinaryNodeSize];
+  std::memset(record, 0, sizeof(record));
+  for (std::size_t i = 0; i < num_ex; ++i) {
+    const Node *x = problem->x[i];
+    do {
+      int32_t index = x->index;
+      std::memcpy(record, &index, 4);
+      std::memcpy(record + 8, &x->value, 8);
+      output_file.write(record, sizeof(record));
+    } while ((x++)->index != -1);
+  }
+
+  if (!output_file.good()) {
+    return -1;
+  }
+  output_file.close();
+
+  return 0;
+}
+
 // label: label name, start: begin of each class, count: #data of classes, perm: indices to the original data
 // perm, length l, must be allocated before calling this subroutine
 void GroupClasses(const Problem *prob, int *num_classes_ret, int **labels_ret, int **start_ret, int **count_ret, int *perm) {
@@ -264,4 +775,113 @@ int *GetLabels(const Problem *prob, int *num_classes_ret) {
   *num_classes_ret = num_classes;
 
   return labels;
-}
\ No newline at end of file
+}
+// the rows are stored densely when at least this fraction of the l*dim values are non-zero
+static const double kDenseRatio = 0.5;
+
+// dim (the largest index) if the rows are dense enough, 0 otherwise
+int GetDenseDim(Node *const *x, int l) {
+  std::size_t num_nodes = 0;
+  int dim = 0;
+
+  for (int i = 0; i < l; ++i) {
+    for (const Node *p = x[i]; p->index != -1; ++p) {
+      if (p->index < 1) {
+        return 0;
+      }
+      if (p->index > dim) {
+        dim = p->index;
+      }
+      ++num_nodes;
+    }
+  }
+
+  if (dim == 0 || static_cast<double>(num_nodes) < kDenseRatio * l * dim) {
+    return 0;
+  }
+
+  return dim;
+}
+
+DenseRows *MakeDenseRows(Node *const *x, int l, int dim) {
+  int align = kDenseAlign / static_cast<int>(sizeof(double));
+  DenseRows *rows = new DenseRows;
+  rows->num_rows = l;
+  rows->dim = dim;
+  rows->stride = (dim + align - 1) / align * align;
+
+  std::size_t size = static_cast<std::size_t>(l) * static_cast<std::size_t>(rows->stride);
+  rows->data = static_cast<double *>(std::aligned_alloc(kDenseAlign, std::max<std::size_t>(size, 1) * sizeof(double)));
+  for (int i = 0; i < l; ++i) {
+    ScatterDense(x[i], rows->data + static_cast<std::size_t>(i) * static_cast<std::size_t>(rows->stride), dim, rows->stride);
+  }
+
+  return rows;
+}
+
+void FreeDenseRows(struct DenseRows *rows) {
+  if (rows != NULL) {
+    std::free(rows->data);
+    delete rows;
+  }
+
+  return;
+}
+
+// write x into dense[0,stride), returns the first node of x beyond dim
+const Node *ScatterDense(const Node *x, double *dense, int dim, int stride) {
+  std::fill(dense, dense+stride, 0.0);
+  for ( ; x->index != -1 && x->index <= dim; ++x) {
+    dense[x->index-1] = x->value;
+  }
+
+  return x;
+}
+
+// n is a multiple of kDenseAlign/sizeof(double), the products are summed in index order, which gives the same
+// result as Dot on the sparse rows, unless built with -DLIBVM_DENSE_LANES (make DENSE_LANES=1) to sum them in
+// independent lanes
+double DotDense(const double *x, const double *y, int n) {
+#if defined(LIBVM_DENSE_LANES) && defined(__AVX512F__)
+  __m512d sum = _mm512_setzero_pd();
+  for (int i = 0; i < n; i += 8) {
+    sum = _mm512_fmadd_pd(_mm512_loadu_pd(x+i), _mm512_loadu_pd(y+i), sum);
+  }
+  return _mm512_reduce_add_pd(sum);
+#elif defined(LIBVM_DENSE_LANES) && defined(__AVX2__)
+  __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+  for (int i = 0; i < n; i += 8) {
+    sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(x+i), _mm256_loadu_pd(y+i)));
+    sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(x+i+4), _mm256_loadu_pd(y+i+4)));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(LIBVM_DENSE_LANES)
+  double sum[4] = {0, 0, 0, 0};
+  for (int i = 0; i < n; i += 4) {
+    sum[0] += x[i] * y[i];
+    sum[1] += x[i+1] * y[i+1];
+    sum[2] += x[i+2] * y[i+2];
+    sum[3] += x[i+3] * y[i+3];
+  }
+  return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+#else
+  double sum = 0;
+  for (int i = 0; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+
+  return sum;
+#endif
+}
+
+// summed in index order, so the result is the same as CalcDist on the sparse rows before the square root
+double SquaredDistDense(const double *x, const double *y, int n) {
+  double sum = 0;
+  for (int i = 0; i < n; ++i) {
+    sum += (x[i] - y[i]) * (x[i] - y[i]);
+  }
+
+  return sum;
+}
@@ -6,21 +6,40 @@
 #include <map>
 #include <cmath>
 #include <cstdarg>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 const double kInf = HUGE_VAL;
 const double kTau = 1e-12;
 const double kEpsilon = 1e-15;
+const int kDenseAlign = 64;  // in bytes
 
 struct Node {
   int index;
   double value;
 };
 
+// row-major copy of the rows of a dense data set, the value of index k of row i is data[i*stride+k-1],
+// stride is padded to a multiple of kDenseAlign bytes and the padding is zero
+struct DenseRows {
+  int num_rows;
+  int dim;
+  int stride;
+  double *data;
+};
+
 struct Problem {
   int num_ex;  // number of examples
   int max_index;
   double *y;
   struct Node **x;
+  struct Node *nodes;  // pool of all the rows that x points into, NULL if each row is allocated on its own
+  void *mapped;  // mapping of a binary data file that y and nodes point into, NULL if they are allocated
+  std::size_t mapped_size;
 };
 
 void PrintCout(const char *s);
@@ -92,9 +111,72 @@ void QuickSortIndex(T array[], size_t index[], size_t left, size_t right) {
   return;
 }
 
+int GetNumThreads(int num_threads);
+void ParallelFor(int num_tasks, int num_threads, const std::function<void(int, int)> &task);
+
+//
+// Worker pool for parallel loops inside an iteration
+//
+// the num_threads-1 workers are started once and spin (then yield) until Run hands them a task,
+// Run calls task(thread) on every thread including the calling one (thread 0) and returns when all
+// of them have finished, so it can be called for every iteration of a solver
+//
+class WorkerPool {
+ public:
+  explicit WorkerPool(int num_threads);
+  ~WorkerPool();
+  int get_num_threads() const {
+    return num_threads_;
+  }
+  void Run(const std::function<void(int)> &task);
+
+ private:
+  int num_threads_;
+  std::vector<std::thread> workers_;
+  const std::function<void(int)> *task_;
+  std::atomic<unsigned> generation_;
+  std::atomic<int> pending_;
+  std::atomic<bool> stop_;
+  std::atomic<int> num_parked_;  // threads (workers or the caller of Run) waiting on the condition variables
+  std::mutex mutex_;
+  std::condition_variable task_ready_;
+  std::condition_variable task_done_;
+  void Work(int thread);
+};
+
+const int kMinParallelRange = 4096;  // smallest part of a range worth a barrier
+
+// run task(part, start, end) over consecutive parts [start,end) of [0,n) on the threads of pool, in one part
+// on the calling thread if pool is NULL or n is small, returns the number of parts
+template <typename F>
+int ParallelRange(WorkerPool *pool, int n, const F &task) {
+  int num_parts = (pool != NULL) ? std::min(pool->get_num_threads(), n / kMinParallelRange) : 1;
+  if (num_parts <= 1) {
+    task(0, 0, n);
+    return 1;
+  }
+  pool->Run([&task, n, num_parts](int part) {
+    if (part < num_parts) {
+      task(part, static_cast<int>(static_cast<long>(n) * part / num_parts), static_cast<int>(static_cast<long>(n) * (part+1) / num_parts));
+    }
+  });
+
+  return num_parts;
+}
+
 Problem *ReadProblem(const char *file_name);
+Problem *ReadProblem(const char *file_name, int num_threads);
+Problem *ReadProblem(std::istream &input, int max_num_ex, int *num_lines);
+int SaveProblem(const char *file_name, const struct Problem *problem);
 void FreeProblem(struct Problem *problem);
 void GroupClasses(const Problem *prob, int *num_classes_ret, int **labels_ret, int **start_ret, int **count_ret, int *perm);
 int *GetLabels(const Problem *prob, int *num_classes_ret);
 
+int GetDenseDim(Node *const *x, int l);
+DenseRows *MakeDenseRows(Node *const *x, int l, int dim);
+void FreeDenseRows(struct DenseRows *rows);
+const Node *ScatterDense(const Node *x, double *dense, int dim, int stride);
+double DotDense(const double *x, const double *y, int n);
+double SquaredDistDense(const double *x, const double *y, int n);
+
 #endif  // LIBVM_UTILITIES_H_
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "utilities.h"
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+void ExitWithHelp();
+void ParseCommandLine(int argc, char *argv[], char *data_file_name, char *binary_file_name);
+
+int num_threads;
+
+int main(int argc, char *argv[]) {
+  char data_file_name[256];
+  char binary_file_name[256];
+  struct Problem *prob;
+
+  ParseCommandLine(argc, argv, data_file_name, binary_file_name);
+
+  prob = ReadProblem(data_file_name, num_threads);
+
+  if (SaveProblem(binary_file_name, prob) != 0) {
+    std::cerr << "Unable to save binary data file: " << binary_file_name << std::endl;
+    FreeProblem(prob);
+    exit(EXIT_FAILURE);
+  }
+
+  std::cout << "Converted " << prob->num_ex << " examples (max index " << prob->max_index << ") to " << binary_file_name << '\n';
+
+  FreeProblem(prob);
+
+  return 0;
+}
+
+void ExitWithHelp() {
+  std::cout << "Usage: vm-convert [options] data_file [binary_file]\n"
+            << "options:\n"
+            << "  -j num_threads : set number of threads for reading data, 0 for all cores (default 1)\n";
+  exit(EXIT_FAILURE);
+}
+
+void ParseCommandLine(int argc, char **argv, char *data_file_name, char *binary_file_name) {
+  int i;
+  num_threads = 1;
+
+  for (i = 1; i < argc; ++i) {
+    if (argv[i][0] != '-') break;
+    if ((i+1) >= argc)
+      ExitWithHelp();
+    switch (argv[i][1]) {
+      case 'j': {
+        ++i;
+        num_threads = std::atoi(argv[i]);
+        if (num_threads < 0) {
+          std::cerr << "number of threads should not be less than 0" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
+      }
+      default: {
+        std::cerr << "Unknown option: -" << argv[i][1] << std::endl;
+        ExitWithHelp();
+      }
+    }
+  }
+
+  if (i >= argc)
+    ExitWithHelp();
+  std::strcpy(data_file_name, argv[i]);
+  if ((i+1) < argc) {
+    std::strcpy(binary_file_name, argv[i+1]);
+  } else {
+    char *p = std::strrchr(argv[i],'/');
+    if (p == NULL) {
+      p = argv[i];
+    } else {
+      ++p;
+    }
+    std::sprintf(binary_file_name, "%s.bin", p);
+  }
+
+  return;
+}
@@ -25,7 +25,7 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  prob = ReadProblem(data_file_name);
+  prob = ReadProblem(data_file_name, param.num_threads);
 
   if ((param.taxonomy_type == SVM_EL ||
        param.taxonomy_type == SVM_ES ||
@@ -83,7 +83,7 @@ int main(int argc, char *argv[]) {
             << "Logarithmic Loss: " << avg_logloss << '\n';
   output_file.close();
 
-  std::cout << "Time cost: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count()/1000.0 << " s\n";
+  std::cout << "Time cost: " << static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count())/1000.0 << " s\n";
 
   FreeProblem(prob);
   FreeParam(&param);
@@ -108,14 +108,21 @@ void ExitWithHelp() {
             << "    5 -- Crammer and Singer's multi-class support vector machine (MCSVM)\n"
             << "    6 -- Crammer and Singer's multi-class support vector machine with equal length (MCSVM_EL)\n"
             << "  -k num_neighbors : set number of neighbors in kNN (default 1)\n"
+            << "  -ks search_type : set type of neighbor search in kNN (default 1)\n"
+            << "    0 -- brute force (BRUTE_FORCE)\n"
+            << "    1 -- vantage-point tree (VP_TREE)\n"
+            << "  -kj num_threads : set number of threads for brute force search in kNN, 0 for all cores (default 1)\n"
             << "  -c num_categories : set number of categories for Venn predictor (default 4)\n"
             << "  -v num_folds : set number of folders in cross validation (default 5)\n"
+            << "  -j num_threads : set number of threads for reading data and cross validation folds, 0 for all cores (default 1)\n"
             << "  -q : turn off quiet mode (no outputs)\n"
             << "  -p : prefix of options to set parameters for SVM\n"
             << "    -ps svm_type : set type of SVM (default 0)\n"
             << "      0 -- C-SVC    (multi-class classification)\n"
             << "      1 -- nu-SVC   (multi-class classification)\n"
             << "      2 -- OVA-SVC  (multi-class classification)\n"
+            << "      3 -- L1-loss linear SVC  (multi-class classification, linear kernel only)\n"
+            << "      4 -- L2-loss linear SVC  (multi-class classification, linear kernel only)\n"
             << "    -pt kernel_type : set type of kernel function (default 2)\n"
             << "      0 -- linear: u'*v\n"
             << "      1 -- polynomial: (gamma*u'*v + coef0)^degree\n"
@@ -125,12 +132,13 @@ void ExitWithHelp() {
             << "    -pd degree : set degree in kernel function (default 3)\n"
             << "    -pg gamma : set gamma in kernel function (default 1/num_features)\n"
             << "    -pr coef0 : set coef0 in kernel function (default 0)\n"
-            << "    -pc cost : set the parameter C of C-SVC (default 1)\n"
+            << "    -pc cost : set the parameter C of C-SVC and linear SVC (default 1)\n"
             << "    -pn nu : set the parameter nu of nu-SVC (default 0.5)\n"
             << "    -pm cachesize : set cache memory size in MB (default 100)\n"
             << "    -pe epsilon : set tolerance of termination criterion (default 0.001)\n"
             << "    -ph shrinking : whether to use the shrinking heuristics, 0 or 1 (default 1)\n"
-            << "    -pwi weights : set the parameter C of class i to weight*C, for C-SVC (default 1)\n"
+            << "    -pj num_threads : set number of threads for training the binary SVMs, 0 for all cores (default 1)\n"
+            << "    -pwi weights : set the parameter C of class i to weight*C, for C-SVC and linear SVC (default 1)\n"
             << "  -m : prefix of options to set parameters for MCSVM\n"
             << "    -ms redopt_type : set type of reduced optimization (default 0)\n"
             << "      0 -- exact (EXACT)\n"
@@ -161,6 +169,7 @@ void ParseCommandLine(int argc, char **argv, char *data_file_name, char *output_
   param.num_categories = 4;
   param.num_folds = 5;
   param.probability = 0;
+  param.num_threads = 1;
   param.knn_param = new KNNParameter;
   param.svm_param = NULL;
   param.mcsvm_param = NULL;
@@ -181,6 +190,7 @@ void ParseCommandLine(int argc, char **argv, char *data_file_name, char *output_
             param.taxonomy_type == OVA_SVM) {
           FreeKNNParam(param.knn_param);
           delete param.knn_param;
+          param.knn_param = NULL;
           param.svm_param = new SVMParameter;
           InitSVMParam(param.svm_param);
           if (param.taxonomy_type == OVA_SVM) {
@@ -191,15 +201,39 @@ void ParseCommandLine(int argc, char **argv, char *data_file_name, char *output_
             param.taxonomy_type == MCSVM_EL) {
           FreeKNNParam(param.knn_param);
           delete param.knn_param;
+          param.knn_param = NULL;
           param.mcsvm_param = new MCSVMParameter;
           InitMCSVMParam(param.mcsvm_param);
         }
         break;
       }
       case 'k': {
-        ++i;
-        if (param.knn_param != NULL) {
-          param.knn_param->num_neighbors = std::atoi(argv[i]);
+        if (argv[i][2]) {
+          switch (argv[i][2]) {
+            case 's': {
+              ++i;
+              if (param.knn_param != NULL) {
+                param.knn_param->search_type = std::atoi(argv[i]);
+              }
+              break;
+            }
+            case 'j': {
+              ++i;
+              if (param.knn_param != NULL) {
+                param.knn_param->num_threads = std::atoi(argv[i]);
+              }
+              break;
+            }
+            default: {
+              std::cerr << "Unknown KNN option: " << argv[i] << std::endl;
+              ExitWithHelp();
+            }
+          }
+        } else {
+          ++i;
+          if (param.knn_param != NULL) {
+            param.knn_param->num_neighbors = std::atoi(argv[i]);
+          }
         }
         break;
       }
@@ -217,6 +251,15 @@ void ParseCommandLine(int argc, char **argv, char *data_file_name, char *output_
         }
         break;
       }
+      case 'j': {
+        ++i;
+        param.num_threads = std::atoi(argv[i]);
+        if (param.num_threads < 0) {
+          std::cerr << "number of threads should not be less than 0" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
+      }
       case 'b': {
         ++i;
         param.probability = std::atoi(argv[i]);
@@ -303,6 +346,13 @@ void ParseCommandLine(int argc, char **argv, char *data_file_name, char *output_
               }
               break;
             }
+            case 'j': {
+              ++i;
+              if (param.svm_param != NULL) {
+                param.svm_param->num_threads = std::atoi(argv[i]);
+              }
+              break;
+            }
             case 'w': {  // weights [option]: '-w1' means weight of '1'
               ++i;
               ++param.svm_param->num_weights;
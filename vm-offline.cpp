@@ -8,15 +8,19 @@ void ExitWithHelp();
 void ParseCommandLine(int argc, char *argv[], char *train_file_name, char *test_file_name, char *output_file_name, char *model_file_name);
 
 struct Parameter param;
+int batch_size;  // 0 to read the test set at once
+const int kDefaultBatchSize = 1000;  // for reading the test set from the standard input
 
 int main(int argc, char *argv[]) {
   char train_file_name[256];
   char test_file_name[256];
   char output_file_name[256];
   char model_file_name[256];
-  struct Problem *train, *test;
+  struct Problem *train, *test = NULL;
   struct Model *model;
-  int num_correct = 0;
+  int num_correct = 0, num_test = 0, num_lines = 0;
+  std::ifstream test_file;
+  std::istream *test_input = &std::cin;
   double avg_lower_bound = 0, avg_upper_bound = 0, avg_brier = 0, avg_logloss = 0;
   const char *error_message;
 
@@ -28,8 +32,17 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  train = ReadProblem(train_file_name);
-  test = ReadProblem(test_file_name);
+  train = ReadProblem(train_file_name, param.num_threads);
+  if (batch_size == 0) {
+    test = ReadProblem(test_file_name, param.num_threads);
+  } else if (std::strcmp(test_file_name, "-") != 0) {
+    test_file.open(test_file_name);
+    if (!test_file.is_open()) {
+      std::cerr << "Unable to open input file: " << test_file_name << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    test_input = &test_file;
+  }
 
   if ((param.taxonomy_type == SVM_EL ||
        param.taxonomy_type == SVM_ES ||
@@ -58,6 +71,10 @@ int main(int argc, char *argv[]) {
     if (model == NULL) {
       exit(EXIT_FAILURE);
     }
+    if (model->param.taxonomy_type == KNN &&
+        model->knn_model->param.search_type == VP_TREE) {
+      BuildKNNIndex(model->knn_model, train);
+    }
   } else {
     model = TrainVM(train, &param);
   }
@@ -76,57 +93,82 @@ int main(int argc, char *argv[]) {
     output_file << '\n';
   }
 
-  for (int i = 0; i < test->num_ex; ++i) {
-    double predict_label, lower_bound, upper_bound, logloss, brier = 0, *avg_prob = NULL;
-
-    predict_label = PredictVM(train, model, test->x[i], lower_bound, upper_bound, &avg_prob);
-
-    for (int j = 0; j < model->num_classes; ++j) {
-      if (model->labels[j] == test->y[i]) {
-        brier += (1-avg_prob[j])*(1-avg_prob[j]);
-        double tmp = std::fmax(std::fmin(avg_prob[j], 1-kEpsilon), kEpsilon);
-        logloss = - std::log(tmp);
-      } else {
-        brier += avg_prob[j]*avg_prob[j];
+  // in streaming mode the test set is read, predicted and written batch by batch
+  for ( ; ; ) {
+    if (batch_size > 0) {
+      test = ReadProblem(*test_input, batch_size, &num_lines);
+      if (test == NULL) {
+        break;
       }
     }
-    avg_lower_bound += lower_bound;
-    avg_upper_bound += upper_bound;
-    avg_brier += brier;
-    avg_logloss += logloss;
 
-    output_file << std::resetiosflags(std::ios::fixed) << test->y[i] << ' ' << predict_label << ' '
-                << std::setiosflags(std::ios::fixed) << lower_bound << ' ' << upper_bound;
-    if (param.probability == 1) {
+    double *predict_labels = new double[test->num_ex];
+    double *lower_bounds = new double[test->num_ex];
+    double *upper_bounds = new double[test->num_ex];
+    double *avg_probs = new double[test->num_ex * model->num_classes];
+
+    PredictVMBatch(train, model, test, param.num_threads, predict_labels, lower_bounds, upper_bounds, avg_probs);
+
+    for (int i = 0; i < test->num_ex; ++i) {
+      double predict_label = predict_labels[i], lower_bound = lower_bounds[i], upper_bound = upper_bounds[i];
+      double logloss, brier = 0, *avg_prob = avg_probs + i * model->num_classes;
+
       for (int j = 0; j < model->num_classes; ++j) {
-        output_file << ' ' << avg_prob[j];
+        if (model->labels[j] == test->y[i]) {
+          brier += (1-avg_prob[j])*(1-avg_prob[j]);
+          double tmp = std::fmax(std::fmin(avg_prob[j], 1-kEpsilon), kEpsilon);
+          logloss = - std::log(tmp);
+        } else {
+          brier += avg_prob[j]*avg_prob[j];
+        }
+      }
+      avg_lower_bound += lower_bound;
+      avg_upper_bound += upper_bound;
+      avg_brier += brier;
+      avg_logloss += logloss;
+
+      output_file << std::resetiosflags(std::ios::fixed) << test->y[i] << ' ' << predict_label << ' '
+                  << std::setiosflags(std::ios::fixed) << lower_bound << ' ' << upper_bound;
+      if (param.probability == 1) {
+        for (int j = 0; j < model->num_classes; ++j) {
+          output_file << ' ' << avg_prob[j];
+        }
+      }
+      output_file << '\n';
+      if (predict_label == test->y[i]) {
+        ++num_correct;
       }
     }
-    output_file << '\n';
-    if (predict_label == test->y[i]) {
-      ++num_correct;
+    num_test += test->num_ex;
+    delete[] predict_labels;
+    delete[] lower_bounds;
+    delete[] upper_bounds;
+    delete[] avg_probs;
+    FreeProblem(test);
+
+    if (batch_size == 0) {
+      break;
     }
-    delete[] avg_prob;
+    output_file.flush();
   }
-  avg_lower_bound /= test->num_ex;
-  avg_upper_bound /= test->num_ex;
-  avg_brier /= test->num_ex;
-  avg_logloss /= test->num_ex;
+  avg_lower_bound /= num_test;
+  avg_upper_bound /= num_test;
+  avg_brier /= num_test;
+  avg_logloss /= num_test;
 
   std::chrono::time_point<std::chrono::steady_clock> end_time = std::chrono::high_resolution_clock::now();
 
-  std::cout << "Accuracy: " << 100.0*num_correct/test->num_ex << '%'
-            << " (" << num_correct << '/' << test->num_ex << ") "
+  std::cout << "Accuracy: " << 100.0*num_correct/num_test << '%'
+            << " (" << num_correct << '/' << num_test << ") "
             << "Probabilities: [" << std::fixed << std::setprecision(4) << 100*avg_lower_bound << "%, "
             << 100*avg_upper_bound << "%] "
             << "Brier Score: " << avg_brier << ' '
             << "Logarithmic Loss: " << avg_logloss << '\n';
   output_file.close();
 
-  std::cout << "Time cost: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count()/1000.0 << " s\n";
+  std::cout << "Time cost: " << static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count())/1000.0 << " s\n";
 
   FreeProblem(train);
-  FreeProblem(test);
   FreeModel(model);
   FreeParam(&param);
 
@@ -135,6 +177,7 @@ int main(int argc, char *argv[]) {
 
 void ExitWithHelp() {
   std::cout << "Usage: vm-offline [options] train_file test_file [output_file]\n"
+            << "test_file can be - to read the test set from the standard input in batches\n"
             << "options:\n"
             << "  -t taxonomy_type : set type of taxonomy (default 0)\n"
             << "    0 -- k-nearest neighbors (KNN)\n"
@@ -145,16 +188,24 @@ void ExitWithHelp() {
             << "    5 -- Crammer and Singer's multi-class support vector machine (MCSVM)\n"
             << "    6 -- Crammer and Singer's multi-class support vector machine with equal length (MCSVM_EL)\n"
             << "  -k num_neighbors : set number of neighbors in kNN (default 1)\n"
+            << "  -ks search_type : set type of neighbor search in kNN (default 1)\n"
+            << "    0 -- brute force (BRUTE_FORCE)\n"
+            << "    1 -- vantage-point tree (VP_TREE)\n"
+            << "  -kj num_threads : set number of threads for brute force search in kNN, 0 for all cores (default 1)\n"
             << "  -c num_categories : set number of categories for Venn predictor (default 4)\n"
             << "  -s model_file_name : save model\n"
             << "  -l model_file_name : load model\n"
             << "  -b probability estimates : whether to output probability estimates for all labels, 0 or 1 (default 0)\n"
+            << "  -j num_threads : set number of threads for reading data and prediction, 0 for all cores (default 1)\n"
+            << "  -r batch_size : read and predict the test set in batches of batch_size examples, 0 to read it at once (default 0, 1000 for -)\n"
             << "  -q : quiet mode (no outputs)\n"
             << "  -p : prefix of options to set parameters for SVM\n"
             << "    -ps svm_type : set type of SVM (default 0)\n"
             << "      0 -- C-SVC    (multi-class classification)\n"
             << "      1 -- nu-SVC   (multi-class classification)\n"
             << "      2 -- OVA-SVC  (multi-class classification)\n"
+            << "      3 -- L1-loss linear SVC  (multi-class classification, linear kernel only)\n"
+            << "      4 -- L2-loss linear SVC  (multi-class classification, linear kernel only)\n"
             << "    -pt kernel_type : set type of kernel function (default 2)\n"
             << "      0 -- linear: u'*v\n"
             << "      1 -- polynomial: (gamma*u'*v + coef0)^degree\n"
@@ -164,12 +215,13 @@ void ExitWithHelp() {
             << "    -pd degree : set degree in kernel function (default 3)\n"
             << "    -pg gamma : set gamma in kernel function (default 1/num_features)\n"
             << "    -pr coef0 : set coef0 in kernel function (default 0)\n"
-            << "    -pc cost : set the parameter C of C-SVC (default 1)\n"
+            << "    -pc cost : set the parameter C of C-SVC and linear SVC (default 1)\n"
             << "    -pn nu : set the parameter nu of nu-SVC (default 0.5)\n"
             << "    -pm cachesize : set cache memory size in MB (default 100)\n"
             << "    -pe epsilon : set tolerance of termination criterion (default 0.001)\n"
             << "    -ph shrinking : whether to use the shrinking heuristics, 0 or 1 (default 1)\n"
-            << "    -pwi weights : set the parameter C of class i to weight*C, for C-SVC (default 1)\n"
+            << "    -pj num_threads : set number of threads for training the binary SVMs, 0 for all cores (default 1)\n"
+            << "    -pwi weights : set the parameter C of class i to weight*C, for C-SVC and linear SVC (default 1)\n"
             << "  -m : prefix of options to set parameters for MCSVM\n"
             << "    -ms redopt_type : set type of reduced optimization (default 0)\n"
             << "      0 -- exact (EXACT)\n"
@@ -199,6 +251,8 @@ void ParseCommandLine(int argc, char **argv, char *train_file_name, char *test_f
   param.load_model = 0;
   param.num_categories = 4;
   param.probability = 0;
+  param.num_threads = 1;
+  batch_size = 0;
   param.knn_param = new KNNParameter;
   param.svm_param = NULL;
   param.mcsvm_param = NULL;
@@ -219,6 +273,7 @@ void ParseCommandLine(int argc, char **argv, char *train_file_name, char *test_f
             param.taxonomy_type == OVA_SVM) {
           FreeKNNParam(param.knn_param);
           delete param.knn_param;
+          param.knn_param = NULL;
           param.svm_param = new SVMParameter;
           InitSVMParam(param.svm_param);
           if (param.taxonomy_type == OVA_SVM) {
@@ -229,15 +284,39 @@ void ParseCommandLine(int argc, char **argv, char *train_file_name, char *test_f
             param.taxonomy_type == MCSVM_EL) {
           FreeKNNParam(param.knn_param);
           delete param.knn_param;
+          param.knn_param = NULL;
           param.mcsvm_param = new MCSVMParameter;
           InitMCSVMParam(param.mcsvm_param);
         }
         break;
       }
       case 'k': {
-        ++i;
-        if (param.knn_param != NULL) {
-          param.knn_param->num_neighbors = std::atoi(argv[i]);
+        if (argv[i][2]) {
+          switch (argv[i][2]) {
+            case 's': {
+              ++i;
+              if (param.knn_param != NULL) {
+                param.knn_param->search_type = std::atoi(argv[i]);
+              }
+              break;
+            }
+            case 'j': {
+              ++i;
+              if (param.knn_param != NULL) {
+                param.knn_param->num_threads = std::atoi(argv[i]);
+              }
+              break;
+            }
+            default: {
+              std::cerr << "Unknown KNN option: " << argv[i] << std::endl;
+              ExitWithHelp();
+            }
+          }
+        } else {
+          ++i;
+          if (param.knn_param != NULL) {
+            param.knn_param->num_neighbors = std::atoi(argv[i]);
+          }
         }
         break;
       }
@@ -263,6 +342,24 @@ void ParseCommandLine(int argc, char **argv, char *train_file_name, char *test_f
         param.probability = std::atoi(argv[i]);
         break;
       }
+      case 'j': {
+        ++i;
+        param.num_threads = std::atoi(argv[i]);
+        if (param.num_threads < 0) {
+          std::cerr << "number of threads should not be less than 0" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
+      }
+      case 'r': {
+        ++i;
+        batch_size = std::atoi(argv[i]);
+        if (batch_size < 0) {
+          std::cerr << "batch size should not be less than 0" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
+      }
       case 'q': {
         SetPrintNull();
         break;
@@ -344,6 +441,13 @@ void ParseCommandLine(int argc, char **argv, char *train_file_name, char *test_f
               }
               break;
             }
+            case 'j': {
+              ++i;
+              if (param.svm_param != NULL) {
+                param.svm_param->num_threads = std::atoi(argv[i]);
+              }
+              break;
+            }
             case 'w': {  // weights [option]: '-w1' means weight of '1'
               ++i;
               ++param.svm_param->num_weights;
@@ -466,5 +570,10 @@ void ParseCommandLine(int argc, char **argv, char *train_file_name, char *test_f
     std::sprintf(output_file_name, "%s_output", p);
   }
 
+  // the standard input can only be read as a stream
+  if (std::strcmp(test_file_name, "-") == 0 && batch_size == 0) {
+    batch_size = kDefaultBatchSize;
+  }
+
   return;
 }
\ No newline at end of file
@@ -3,6 +3,10 @@
 #include <fstream>
 #include <cmath>
 #include <random>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
 
 double CalcCombinedDecisionValues(const double *decision_values, int num_classes, int label) {
   if (num_classes == 2) {
@@ -68,7 +72,15 @@ double *GetEqualLengthCategoryForMCSVM(double *combined_decision_values, int *ca
   }
 
   for (int i = 0; i < num_ex; ++i) {
-    categories[i] = static_cast<int>((combined_decision_values[i] - min_cdv) / interval);
+    // a single example or equal decision values leave no interval to divide by
+    if (interval > 0) {
+      categories[i] = static_cast<int>((combined_decision_values[i] - min_cdv) / interval);
+    } else {
+      categories[i] = 0;
+    }
+    if (categories[i] < 0) {
+      categories[i] = 0;
+    }
     if (categories[i] >= num_categories) {
       categories[i] = num_categories - 1;
     }
@@ -156,9 +168,142 @@ double *GetKMeansCategory(const double *combined_decision_values, int *categorie
   return centroid;
 }
 
+int GetNumCategoryRows(int num_categories, int num_classes) {
+  // OVA_SVM and MCSVM use the predicted label index as the category
+  return std::max(num_categories, num_classes);
+}
+
+int **CalcCategoryCounts(const struct Problem *train, const int *categories, const int *labels, int num_categories, int num_classes) {
+  int num_rows = GetNumCategoryRows(num_categories, num_classes);
+  int **category_counts = new int*[num_rows];
+
+  for (int i = 0; i < num_rows; ++i) {
+    category_counts[i] = new int[num_classes];
+    for (int j = 0; j < num_classes; ++j) {
+      category_counts[i][j] = 0;
+    }
+  }
+
+  for (int i = 0; i < train->num_ex; ++i) {
+    if (categories[i] < 0 || categories[i] >= num_rows) {
+      continue;
+    }
+    for (int j = 0; j < num_classes; ++j) {
+      if (labels[j] == train->y[i]) {
+        ++category_counts[categories[i]][j];
+        break;
+      }
+    }
+  }
+
+  return category_counts;
+}
+
+int PredictCategory(const struct Model *model, const struct Node *x) {
+  const Parameter &param = model->param;
+  int num_classes = model->num_classes;
+  int num_categories = model->num_categories;
+  int *labels = model->labels;
+  int category = -1;
+
+  if (param.taxonomy_type == SVM_EL ||
+      param.taxonomy_type == SVM_ES ||
+      param.taxonomy_type == SVM_KM) {
+    double *decision_values = new double[num_classes*(num_classes-1)/2];
+    int label = 0;
+    double predict_label = PredictSVMValues(model->svm_model, x, decision_values);
+    for (int j = 0; j < num_classes; ++j) {
+      if (predict_label == labels[j]) {
+        label = j;
+        break;
+      }
+    }
+    double combined_decision_values = CalcCombinedDecisionValues(decision_values, num_classes, label);
+    if (param.taxonomy_type == SVM_EL) {
+      category = GetEqualLengthCategory(combined_decision_values, num_categories, num_classes);
+    }
+    if (param.taxonomy_type == SVM_ES) {
+      if (num_classes == 1) {
+        category = 0;
+      } else {
+        int j;
+        for (j = 0; j < num_categories; ++j) {
+          if (combined_decision_values <= model->points[j]) {
+            category = j;
+            break;
+          }
+        }
+        if (j == num_categories) {
+          category = num_categories - 1;
+        }
+      }
+    }
+    if (param.taxonomy_type == SVM_KM) {
+      category = AssignCluster(num_categories, combined_decision_values, model->points);
+    }
+    delete[] decision_values;
+  }
+
+  if (param.taxonomy_type == OVA_SVM) {
+    int label = 0;
+    double predict_label = PredictSVM(model->svm_model, x);
+    for (int j = 0; j < num_classes; ++j) {
+      if (predict_label == labels[j]) {
+        label = j;
+        break;
+      }
+    }
+    category = label;
+  }
+
+  if (param.taxonomy_type == MCSVM) {
+    int temp;
+    int label = PredictMCSVM(model->mcsvm_model, x, &temp);
+    for (int j = 0; j < num_classes; ++j) {
+      if (label == labels[j]) {
+        category = j;
+        break;
+      }
+    }
+  }
+
+  if (param.taxonomy_type == MCSVM_EL) {
+    double combined_decision_value = PredictMCSVMMaxValue(model->mcsvm_model, x);
+    int j;
+    for (j = 0; j < num_categories; ++j) {
+      if (combined_decision_value <= model->points[j]) {
+        category = j;
+        break;
+      }
+    }
+    if (j == num_categories) {
+      category = num_categories - 1;
+    }
+  }
+
+  return category;
+}
+
 Model *TrainVM(const struct Problem *train, const struct Parameter *param) {
+  return TrainVM(train, param, NULL);
+}
+
+// init_model (if not NULL) was trained on a prefix of train with the same param,
+// the SVM and MCSVM solvers are warm started from its solution
+Model *TrainVM(const struct Problem *train, const struct Parameter *param, const struct Model *init_model) {
+  return TrainVM(train, param, init_model, NULL);
+}
+
+// workspace (if not NULL) keeps the arrays of the SVM solvers for the next call
+Model *TrainVM(const struct Problem *train, const struct Parameter *param, const struct Model *init_model, struct SVMWorkspace *workspace) {
+  return TrainVM(train, param, init_model, workspace, NULL);
+}
+
+// mcsvm_workspace (if not NULL) keeps the MCSVM solver to grow with the training set of the next call
+Model *TrainVM(const struct Problem *train, const struct Parameter *param, const struct Model *init_model, struct SVMWorkspace *workspace, struct MCSVMWorkspace *mcsvm_workspace) {
   Model *model = new Model;
   model->param = *param;
+  model->category_counts = NULL;
   int num_ex = train->num_ex;
 
   if (param->taxonomy_type == KNN) {
@@ -201,7 +346,7 @@ Model *TrainVM(const struct Problem *train, const struct Parameter *param) {
       combined_decision_values[i] = 0;
     }
 
-    model->svm_model = TrainSVM(train, param->svm_param);
+    model->svm_model = TrainSVM(train, param->svm_param, (init_model != NULL) ? init_model->svm_model : NULL, workspace);
 
     int num_classes = model->svm_model->num_classes;
     if (num_classes == 1) {
@@ -270,7 +415,7 @@ Model *TrainVM(const struct Problem *train, const struct Parameter *param) {
       categories[i] = -1;
     }
 
-    model->svm_model = TrainSVM(train, param->svm_param);
+    model->svm_model = TrainSVM(train, param->svm_param, (init_model != NULL) ? init_model->svm_model : NULL, workspace);
 
     int num_classes = model->svm_model->num_classes;
     if (num_classes == 1) {
@@ -309,7 +454,7 @@ Model *TrainVM(const struct Problem *train, const struct Parameter *param) {
       categories[i] = -1;
     }
 
-    model->mcsvm_model = TrainMCSVM(train, param->mcsvm_param);
+    model->mcsvm_model = TrainMCSVM(train, param->mcsvm_param, (init_model != NULL) ? init_model->mcsvm_model : NULL, mcsvm_workspace);
 
     int num_classes = model->mcsvm_model->num_classes;
     if (num_classes == 1) {
@@ -354,231 +499,215 @@ Model *TrainVM(const struct Problem *train, const struct Parameter *param) {
     clone(model->labels, model->mcsvm_model->labels, num_classes);
   }
 
+  if (model->categories != NULL) {
+    model->category_counts = CalcCategoryCounts(train, model->categories, model->labels, model->num_categories, model->num_classes);
+  }
+
   return model;
 }
 
-double PredictVM(const struct Problem *train, const struct Model *model, const struct Node *x, double &lower, double &upper, double **avg_prob) {
-  const Parameter& param = model->param;
-  int num_ex = model->num_ex;
-  int num_classes = model->num_classes;
-  int num_categories = model->num_categories;
-  int *labels = model->labels;
-  double predict_label;
-  int **f_matrix = new int*[num_classes];
-  int *alter_labels = new int[num_ex];
-
-  for (int i = 0; i < num_classes; ++i) {
-    for (int j = 0; j < num_ex; ++j) {
-      if (labels[i] == train->y[j]) {
-        alter_labels[j] = i;
-      }
+int GetLabelIndex(const struct Model *model, const int *alter_labels, double y, int i) {
+  if (alter_labels != NULL) {
+    return alter_labels[i];
+  }
+  for (int j = 0; j < model->num_classes; ++j) {
+    if (model->labels[j] == y) {
+      return j;
     }
   }
 
-  if (param.taxonomy_type == KNN) {
-    int num_neighbors = param.knn_param->num_neighbors;
-    for (int i = 0; i < num_classes; ++i) {
-      int *categories = new int[num_ex+1];
-      double **dist_neighbors = new double*[num_ex+1];
-      int **label_neighbors = new int*[num_ex+1];
-      f_matrix[i] = new int[num_classes];
-      for (int j = 0; j < num_classes; ++j) {
-        f_matrix[i][j] = 0;
-      }
+  return -1;
+}
 
-      for (int j = 0; j < num_ex; ++j) {
-        clone(dist_neighbors[j], model->knn_model->dist_neighbors[j], num_neighbors);
-        clone(label_neighbors[j], model->knn_model->label_neighbors[j], num_neighbors);
-        categories[j] = model->categories[j];
-      }
-      dist_neighbors[num_ex] = new double[num_neighbors];
-      label_neighbors[num_ex] = new int[num_neighbors];
-      for (int j = 0; j < num_neighbors; ++j) {
-        dist_neighbors[num_ex][j] = kInf;
-        label_neighbors[num_ex][j] = -1;
-      }
-      categories[num_ex] = -1;
+void GetCategoryCounts(const struct Model *model, const int *alter_labels, int category, int *counts) {
+  if (model->category_counts != NULL && category >= 0) {
+    for (int j = 0; j < model->num_classes; ++j) {
+      counts[j] = model->category_counts[category][j];
+    }
+    return;
+  }
 
-      for (int j = 0; j < num_ex; ++j) {
-        double dist = CalcDist(train->x[j], x);
-        int index;
-        index = CompareDist(dist_neighbors[j], dist, num_neighbors);
-        if (index < num_neighbors) {
-          InsertLabel(label_neighbors[j], i, num_neighbors, index);
-        }
-        index = CompareDist(dist_neighbors[num_ex], dist, num_neighbors);
-        if (index < num_neighbors) {
-          InsertLabel(label_neighbors[num_ex], alter_labels[j], num_neighbors, index);
-        }
+  for (int j = 0; j < model->num_classes; ++j) {
+    counts[j] = 0;
+  }
+  if (alter_labels != NULL) {
+    for (int j = 0; j < model->num_ex; ++j) {
+      if (model->categories[j] == category) {
+        ++counts[alter_labels[j]];
       }
+    }
+  }
 
-      for (int j = 0; j < num_ex+1; ++j) {
-        categories[j] = FindMostFrequent(label_neighbors[j], num_neighbors);
-      }
+  return;
+}
 
-      for (int j = 0; j < num_ex; ++j) {
-        if (categories[j] == categories[num_ex]) {
-          ++f_matrix[i][alter_labels[j]];
-        }
-      }
-      f_matrix[i][i]++;
+// alter_labels[i]: index of train->y[i] in model->labels, only needed when the model has no category_counts
+static int *CalcAlterLabels(const struct Problem *train, const struct Model *model) {
+  if (model->category_counts != NULL) {
+    return NULL;
+  }
 
-      for (int j = 0; j < num_ex+1; ++j) {
-        delete[] dist_neighbors[j];
-        delete[] label_neighbors[j];
+  int *alter_labels = new int[model->num_ex];
+  for (int i = 0; i < model->num_classes; ++i) {
+    for (int j = 0; j < model->num_ex; ++j) {
+      if (model->labels[i] == train->y[j]) {
+        alter_labels[j] = i;
       }
-
-      delete[] dist_neighbors;
-      delete[] label_neighbors;
-      delete[] categories;
     }
   }
 
-  if (param.taxonomy_type == SVM_EL ||
-      param.taxonomy_type == SVM_ES ||
-      param.taxonomy_type == SVM_KM) {
+  return alter_labels;
+}
+
+// buffers of one prediction, allocated once per thread for a batch of predictions
+struct PredictWorkspace {
+  PredictWorkspace(const struct Model *model) {
+    num_classes = model->num_classes;
+    num_neighbors = (model->param.taxonomy_type == KNN) ? model->param.knn_param->num_neighbors : 0;
+    f_matrix = new int*[num_classes];
+    matrix = new double*[num_classes];
     for (int i = 0; i < num_classes; ++i) {
-      int *categories = new int[num_ex+1];
       f_matrix[i] = new int[num_classes];
-      for (int j = 0; j < num_classes; ++j) {
-        f_matrix[i][j] = 0;
-      }
+      matrix[i] = new double[num_classes];
+    }
+    counts = new int[num_classes];
+    quality = new double[num_classes];
+    dist_neighbors = new double[num_neighbors];
+    label_neighbors = new int[num_neighbors];
+    index_neighbors = new int[num_neighbors];
+  }
 
-      for (int j = 0; j < num_ex; ++j) {
-        categories[j] = model->categories[j];
-      }
-      categories[num_ex] = -1;
+  ~PredictWorkspace() {
+    for (int i = 0; i < num_classes; ++i) {
+      delete[] f_matrix[i];
+      delete[] matrix[i];
+    }
+    delete[] f_matrix;
+    delete[] matrix;
+    delete[] counts;
+    delete[] quality;
+    delete[] dist_neighbors;
+    delete[] label_neighbors;
+    delete[] index_neighbors;
+  }
 
-      double *decision_values = new double[num_classes*(num_classes-1)/2];
-      int label = 0;
-      double predict_label = PredictSVMValues(model->svm_model, x, decision_values);
-      for (int j = 0; j < num_classes; ++j) {
-        if (predict_label == labels[j]) {
-          label = j;
-          break;
-        }
-      }
-      double combined_decision_values = CalcCombinedDecisionValues(decision_values, num_classes, label);
-      if (param.taxonomy_type == SVM_EL) {
-        categories[num_ex] = GetEqualLengthCategory(combined_decision_values, num_categories, num_classes);
-      }
-      if (param.taxonomy_type == SVM_ES) {
-        if (num_classes == 1) {
-          categories[num_ex] = 0;
-        } else {
-          int j;
-          for (j = 0; j < num_categories; ++j) {
-            if (combined_decision_values <= model->points[j]) {
-              categories[num_ex] = j;
-              break;
-            }
-          }
-          if (j == num_categories) {
-            categories[num_ex] = num_categories - 1;
-          }
-        }
-      }
-      if (param.taxonomy_type == SVM_KM) {
-        categories[num_ex] = AssignCluster(num_categories, combined_decision_values, model->points);
-      }
-      delete[] decision_values;
-      for (int j = 0; j < num_ex; ++j) {
-        if (categories[j] == categories[num_ex]) {
-          ++f_matrix[i][alter_labels[j]];
-        }
-      }
-      f_matrix[i][i]++;
+  int num_classes;
+  int num_neighbors;
+  int **f_matrix;
+  double **matrix;
+  int *counts;
+  double *quality;
+  double *dist_neighbors;
+  int *label_neighbors;
+  int *index_neighbors;
+  std::vector<int> rknn, rknn_index, rknn_labels;
+  std::vector<double> rknn_dists;
+};
+
+static double PredictVM(const struct Problem *train, const struct Model *model, const int *alter_labels, const struct Node *x, double &lower, double &upper, double *avg_prob, PredictWorkspace &workspace) {
+  const Parameter& param = model->param;
+  int num_ex = model->num_ex;
+  int num_classes = model->num_classes;
+  int *labels = model->labels;
+  int **f_matrix = workspace.f_matrix;
+  double **matrix = workspace.matrix;
+  int *counts = workspace.counts;
+  int category = -1;
 
-      delete[] categories;
+  if (param.taxonomy_type == KNN) {
+    // only the reverse neighbours of x (training examples whose neighbour list x would enter)
+    // change their categories, all the others keep model->categories
+    int num_neighbors = param.knn_param->num_neighbors;
+    double *dist_neighbors = workspace.dist_neighbors;
+    int *label_neighbors = workspace.label_neighbors;
+    std::vector<int> &rknn = workspace.rknn;
+    std::vector<int> &rknn_index = workspace.rknn_index;
+    std::vector<int> &rknn_labels = workspace.rknn_labels;
+
+    rknn.clear();
+    rknn_index.clear();
+    rknn_labels.clear();
+    for (int j = 0; j < num_neighbors; ++j) {
+      dist_neighbors[j] = kInf;
+      label_neighbors[j] = -1;
     }
-  }
 
-  if (param.taxonomy_type == OVA_SVM) {
-    for (int i = 0; i < num_classes; ++i) {
-      int *categories = new int[num_ex+1];
-      f_matrix[i] = new int[num_classes];
-      for (int j = 0; j < num_classes; ++j) {
-        f_matrix[i][j] = 0;
-      }
+    if (model->knn_model->tree != NULL) {
+      const VPTree *tree = model->knn_model->tree;
+      int *index_neighbors = workspace.index_neighbors;
+      std::vector<double> &rknn_dists = workspace.rknn_dists;
 
-      for (int j = 0; j < num_ex; ++j) {
-        categories[j] = model->categories[j];
+      tree->Search(x, num_neighbors, -1, dist_neighbors, index_neighbors);
+      for (int j = 0; j < num_neighbors; ++j) {
+        if (index_neighbors[j] != -1) {
+          label_neighbors[j] = GetLabelIndex(model, alter_labels, train->y[index_neighbors[j]], index_neighbors[j]);
+        }
       }
-      categories[num_ex] = -1;
 
-      int label = 0;
-      double predict_label = PredictSVM(model->svm_model, x);
-      for (int j = 0; j < num_classes; ++j) {
-        if (predict_label == labels[j]) {
-          label = j;
-          break;
-        }
+      tree->SearchReverse(x, rknn, rknn_dists);
+      for (std::size_t r = 0; r < rknn.size(); ++r) {
+        int j = rknn[r];
+        const double *neighbors = model->knn_model->dist_neighbors[j];
+        int index;
+        for (index = 0; rknn_dists[r] >= neighbors[index]; ++index) {}
+        rknn_index.push_back(index);
+        rknn_labels.push_back(GetLabelIndex(model, alter_labels, train->y[j], j));
       }
-      categories[num_ex] = label;
+    } else {
       for (int j = 0; j < num_ex; ++j) {
-        if (categories[j] == categories[num_ex]) {
-          ++f_matrix[i][alter_labels[j]];
+        double dist = CalcDist(train->x[j], x);
+        const double *neighbors = model->knn_model->dist_neighbors[j];
+        int index;
+        if (dist < neighbors[num_neighbors-1]) {
+          for (index = 0; dist >= neighbors[index]; ++index) {}
+          rknn.push_back(j);
+          rknn_index.push_back(index);
+          rknn_labels.push_back(GetLabelIndex(model, alter_labels, train->y[j], j));
+        }
+        index = CompareDist(dist_neighbors, dist, num_neighbors);
+        if (index < num_neighbors) {
+          InsertLabel(label_neighbors, GetLabelIndex(model, alter_labels, train->y[j], j), num_neighbors, index);
         }
       }
-      f_matrix[i][i]++;
-
-      delete[] categories;
     }
-  }
+    category = FindMostFrequent(label_neighbors, num_neighbors);
+    GetCategoryCounts(model, alter_labels, category, counts);
 
-  if (param.taxonomy_type == MCSVM ||
-      param.taxonomy_type == MCSVM_EL) {
     for (int i = 0; i < num_classes; ++i) {
-      int *categories = new int[num_ex+1];
-      f_matrix[i] = new int[num_classes];
       for (int j = 0; j < num_classes; ++j) {
-        f_matrix[i][j] = 0;
-      }
-
-      for (int j = 0; j < num_ex; ++j) {
-        categories[j] = model->categories[j];
+        f_matrix[i][j] = counts[j];
       }
-      categories[num_ex] = -1;
 
-      if (param.taxonomy_type == MCSVM) {
-        int temp;
-        int label = PredictMCSVM(model->mcsvm_model, x, &temp);
-        for (int j = 0; j < num_classes; ++j) {
-          if (label == labels[j]) {
-            categories[num_ex] = j;
-            break;
-          }
+      for (std::size_t r = 0; r < rknn.size(); ++r) {
+        int j = rknn[r];
+        for (int k = 0; k < num_neighbors; ++k) {
+          label_neighbors[k] = model->knn_model->label_neighbors[j][k];
         }
-      }
-
-      if (param.taxonomy_type == MCSVM_EL) {
-        double combined_decision_value = PredictMCSVMMaxValue(model->mcsvm_model, x);
-        int j;
-        for (j = 0; j < num_categories; ++j) {
-          if (combined_decision_value <= model->points[j]) {
-            categories[num_ex] = j;
-            break;
-          }
+        InsertLabel(label_neighbors, i, num_neighbors, rknn_index[r]);
+        if (model->categories[j] == category) {
+          --f_matrix[i][rknn_labels[r]];
         }
-        if (j == num_categories) {
-          categories[num_ex] = num_categories - 1;
+        if (FindMostFrequent(label_neighbors, num_neighbors) == category) {
+          ++f_matrix[i][rknn_labels[r]];
         }
       }
+      f_matrix[i][i]++;
+    }
+  } else {
+    // the category of x does not depend on the hypothesised label,
+    // so each row of the Venn matrix is the category's label counts plus x itself
+    category = PredictCategory(model, x);
+    GetCategoryCounts(model, alter_labels, category, counts);
 
-      for (int j = 0; j < num_ex; ++j) {
-        if (categories[j] == categories[num_ex]) {
-          ++f_matrix[i][alter_labels[j]];
-        }
+    for (int i = 0; i < num_classes; ++i) {
+      for (int j = 0; j < num_classes; ++j) {
+        f_matrix[i][j] = counts[j];
       }
       f_matrix[i][i]++;
-
-      delete[] categories;
     }
   }
 
-  double **matrix = new double*[num_classes];
   for (int i = 0; i < num_classes; ++i) {
-    matrix[i] = new double[num_classes];
     int sum = 0;
     for (int j = 0; j < num_classes; ++j) {
       sum += f_matrix[i][j];
@@ -588,18 +717,17 @@ double PredictVM(const struct Problem *train, const struct Model *model, const s
     }
   }
 
-  double *quality = new double[num_classes];
-  *avg_prob = new double[num_classes];
+  double *quality = workspace.quality;
   for (int j = 0; j < num_classes; ++j) {
     quality[j] = matrix[0][j];
-    (*avg_prob)[j] = matrix[0][j];
+    avg_prob[j] = matrix[0][j];
     for (int i = 1; i < num_classes; ++i) {
       if (matrix[i][j] < quality[j]) {
         quality[j] = matrix[i][j];
       }
-      (*avg_prob)[j] += matrix[i][j];
+      avg_prob[j] += matrix[i][j];
     }
-    (*avg_prob)[j] /= num_classes;
+    avg_prob[j] /= num_classes;
   }
 
   int best = 0;
@@ -617,20 +745,58 @@ double PredictVM(const struct Problem *train, const struct Model *model, const s
     }
   }
 
-  predict_label = labels[best];
+  return labels[best];
+}
 
-  delete[] alter_labels;
-  delete[] quality;
-  for (int i = 0; i < num_classes; ++i) {
-    delete[] f_matrix[i];
-    delete[] matrix[i];
+double PredictVM(const struct Problem *train, const struct Model *model, const struct Node *x, double &lower, double &upper, double **avg_prob) {
+  int *alter_labels = CalcAlterLabels(train, model);
+  PredictWorkspace workspace(model);
+
+  *avg_prob = new double[model->num_classes];
+  double predict_label = PredictVM(train, model, alter_labels, x, lower, upper, *avg_prob, workspace);
+
+  if (alter_labels != NULL) {
+    delete[] alter_labels;
   }
-  delete[] f_matrix;
-  delete[] matrix;
 
   return predict_label;
 }
 
+// number of test examples handed to a thread at a time
+static const int kPredictBlockSize = 64;
+
+void PredictVMBatch(const struct Problem *train, const struct Model *model, const struct Problem *test, int num_threads,
+    double *predict_labels, double *lower_bounds, double *upper_bounds, double *avg_probs) {
+  int num_ex = test->num_ex;
+  int num_classes = model->num_classes;
+  int num_blocks = (num_ex + kPredictBlockSize - 1) / kPredictBlockSize;
+  int *alter_labels = CalcAlterLabels(train, model);
+
+  num_threads = std::max(1, std::min(GetNumThreads(num_threads), num_blocks));
+  std::vector<PredictWorkspace *> workspaces;
+  for (int i = 0; i < num_threads; ++i) {
+    workspaces.push_back(new PredictWorkspace(model));
+  }
+
+  ParallelFor(num_blocks, num_threads, [&](int b, int thread) {
+    int end = std::min((b+1) * kPredictBlockSize, num_ex);
+    for (int i = b * kPredictBlockSize; i < end; ++i) {
+      predict_labels[i] = PredictVM(train, model, alter_labels, test->x[i], lower_bounds[i], upper_bounds[i],
+                                    avg_probs + static_cast<std::size_t>(i) * static_cast<std::size_t>(num_classes),
+                                    *workspaces[static_cast<std::size_t>(thread)]);
+    }
+  });
+
+  for (std::size_t i = 0; i < workspaces.size(); ++i) {
+    delete workspaces[i];
+  }
+  if (alter_labels != NULL) {
+    delete[] alter_labels;
+  }
+
+  return;
+}
+
 void CrossValidation(const struct Problem *prob, const struct Parameter *param,
     double *predict_labels, double *lower_bounds, double *upper_bounds,
     double *brier, double *logloss) {
@@ -710,11 +876,36 @@ void CrossValidation(const struct Problem *prob, const struct Parameter *param,
     }
   }
 
-  for (int i = 0; i < num_folds; ++i) {
+  // the folds write to disjoint perm[j] slots, so they are trained and predicted on
+  // param->num_threads threads, the probability outputs are buffered and printed in fold order
+  std::vector<std::string> outputs(static_cast<std::size_t>(num_folds));
+
+  // when the folds run in parallel, the cores are split among them, so that the threads of -pj and -kj
+  // inside each fold are at most the cores divided by the number of fold threads
+  int fold_threads = std::max(1, std::min(GetNumThreads(param->num_threads), num_folds));
+  Parameter fold_param = *param;
+  SVMParameter fold_svm_param;
+  KNNParameter fold_knn_param;
+  if (fold_threads > 1) {
+    int inner_threads = std::max(1, GetNumThreads(0) / fold_threads);
+    if (param->svm_param != NULL) {
+      fold_svm_param = *param->svm_param;
+      fold_svm_param.num_threads = std::min(GetNumThreads(fold_svm_param.num_threads), inner_threads);
+      fold_param.svm_param = &fold_svm_param;
+    }
+    if (param->knn_param != NULL) {
+      fold_knn_param = *param->knn_param;
+      fold_knn_param.num_threads = std::min(GetNumThreads(fold_knn_param.num_threads), inner_threads);
+      fold_param.knn_param = &fold_knn_param;
+    }
+  }
+
+  ParallelFor(num_folds, fold_threads, [&](int i, int) {
     int begin = fold_start[i];
     int end = fold_start[i+1];
     int k = 0;
     struct Problem subprob;
+    std::ostringstream output;
 
     subprob.num_ex = num_ex - (end-begin);
     subprob.x = new Node*[subprob.num_ex];
@@ -731,13 +922,13 @@ void CrossValidation(const struct Problem *prob, const struct Parameter *param,
       ++k;
     }
 
-    struct Model *submodel = TrainVM(&subprob, param);
+    struct Model *submodel = TrainVM(&subprob, &fold_param);
 
     if (param->probability == 1) {
       for (int j = 0; j < submodel->num_classes; ++j) {
-        std::cout << submodel->labels[j] << "        ";
+        output << submodel->labels[j] << "        ";
       }
-      std::cout << '\n';
+      output << '\n';
     }
 
     for (int j = begin; j < end; ++j) {
@@ -757,15 +948,20 @@ void CrossValidation(const struct Problem *prob, const struct Parameter *param,
       }
       if (param->probability == 1) {
         for (k = 0; k < submodel->num_classes; ++k) {
-          std::cout << avg_prob[k] << ' ';
+          output << avg_prob[k] << ' ';
         }
-        std::cout << '\n';
+        output << '\n';
       }
       delete[] avg_prob;
     }
     FreeModel(submodel);
     delete[] subprob.x;
     delete[] subprob.y;
+    outputs[static_cast<std::size_t>(i)] = output.str();
+  });
+
+  for (std::size_t i = 0; i < outputs.size(); ++i) {
+    std::cout << outputs[i];
   }
   delete[] fold_start;
   delete[] perm;
@@ -806,78 +1002,94 @@ void OnlinePredict(const struct Problem *prob, const struct Parameter *param,
       categories[i] = -1;
     }
 
+    // the matrices of every step are sized for all the labels of prob, a step uses the first num_classes
+    std::vector<int> all_labels(static_cast<std::size_t>(num_ex));
+    for (int i = 0; i < num_ex; ++i) {
+      all_labels[static_cast<std::size_t>(i)] = static_cast<int>(prob->y[i]);
+    }
+    std::sort(all_labels.begin(), all_labels.end());
+    int max_classes = static_cast<int>(std::unique(all_labels.begin(), all_labels.end()) - all_labels.begin());
+
+    int **f_matrix = new int*[max_classes];
+    double **matrix = new double*[max_classes];
+    for (int j = 0; j < max_classes; ++j) {
+      f_matrix[j] = new int[max_classes];
+      matrix[j] = new double[max_classes];
+    }
+    double *quality = new double[max_classes];
+    double *avg_prob = new double[max_classes];
+
     int this_label = static_cast<int>(prob->y[indices[0]]);
     labels.push_back(this_label);
     alter_labels[0] = 0;
     num_classes = 1;
 
+    // buffers reused by every step, only the reverse neighbours of x_i (previous examples
+    // whose neighbour list x_i would enter) change their neighbour lists and categories
+    int *label_neighbors_ = new int[num_neighbors];
+    std::vector<int> rknn, rknn_index;
+    std::vector<double> rknn_dists;
+    std::vector<int> counts;
+
+    rknn.reserve(static_cast<std::size_t>(num_ex));
+    rknn_index.reserve(static_cast<std::size_t>(num_ex));
+    rknn_dists.reserve(static_cast<std::size_t>(num_ex));
+
     for (int i = 1; i < num_ex; ++i) {
       if (num_classes == 1)
         std::cerr <<
           "WARNING: training set only has one class. See README for details."
                   << std::endl;
 
-      int **f_matrix = new int*[num_classes];
-
-      for (int j = 0; j < num_classes; ++j) {
-        f_matrix[j] = new int[num_classes];
-        for (int k = 0; k < num_classes; ++k) {
-          f_matrix[j][k] = 0;
-        }
-
-        double **dist_neighbors_ = new double*[i+1];
-        int **label_neighbors_ = new int*[i+1];
-
-        for (int j = 0; j < i; ++j) {
-          clone(dist_neighbors_[j], dist_neighbors[j], num_neighbors);
-          clone(label_neighbors_[j], label_neighbors[j], num_neighbors);
+      rknn.clear();
+      rknn_index.clear();
+      rknn_dists.clear();
+      for (int k = 0; k < i; ++k) {
+        double dist = CalcDist(prob->x[indices[k]], prob->x[indices[i]]);
+        const double *neighbors = dist_neighbors[k];
+        int index;
+        if (dist < neighbors[num_neighbors-1]) {
+          for (index = 0; dist >= neighbors[index]; ++index) {}
+          rknn.push_back(k);
+          rknn_index.push_back(index);
+          rknn_dists.push_back(dist);
         }
-        dist_neighbors_[i] = new double[num_neighbors];
-        label_neighbors_[i] = new int[num_neighbors];
-        for (int j = 0; j < num_neighbors; ++j) {
-          dist_neighbors_[i][j] = kInf;
-          label_neighbors_[i][j] = -1;
+        index = CompareDist(dist_neighbors[i], dist, num_neighbors);
+        if (index < num_neighbors) {
+          InsertLabel(label_neighbors[i], alter_labels[k], num_neighbors, index);
         }
+      }
+      categories[i] = FindMostFrequent(label_neighbors[i], num_neighbors);
 
-        for (int k = 0; k < i; ++k) {
-          double dist = CalcDist(prob->x[indices[k]], prob->x[indices[i]]);
-          int index;
-
-          index = CompareDist(dist_neighbors_[i], dist, num_neighbors);
-          if (index < num_neighbors) {
-            InsertLabel(label_neighbors_[i], alter_labels[k], num_neighbors, index);
-          }
-          index = CompareDist(dist_neighbors_[k], dist, num_neighbors);
-          if (index < num_neighbors) {
-            InsertLabel(label_neighbors_[k], j, num_neighbors, index);
-          }
+      counts.assign(static_cast<std::size_t>(num_classes), 0);
+      for (int k = 0; k < i; ++k) {
+        if (categories[k] == categories[i]) {
+          ++counts[static_cast<std::size_t>(alter_labels[k])];
         }
-        for (int k = 0; k <= i; ++k) {
-          categories[k] = FindMostFrequent(label_neighbors_[k], num_neighbors);
+      }
+
+      for (int j = 0; j < num_classes; ++j) {
+        for (int k = 0; k < num_classes; ++k) {
+          f_matrix[j][k] = counts[static_cast<std::size_t>(k)];
         }
 
-        for (int k = 0; k < i; ++k) {
+        for (std::size_t r = 0; r < rknn.size(); ++r) {
+          int k = rknn[r];
+          for (int l = 0; l < num_neighbors; ++l) {
+            label_neighbors_[l] = label_neighbors[k][l];
+          }
+          InsertLabel(label_neighbors_, j, num_neighbors, rknn_index[r]);
           if (categories[k] == categories[i]) {
+            --f_matrix[j][alter_labels[k]];
+          }
+          if (FindMostFrequent(label_neighbors_, num_neighbors) == categories[i]) {
             ++f_matrix[j][alter_labels[k]];
           }
         }
         f_matrix[j][j]++;
-
-        for (int j = 0; j < num_neighbors; ++j) {
-          dist_neighbors[i][j] = dist_neighbors_[i][j];
-          label_neighbors[i][j] = label_neighbors_[i][j];
-        }
-        for (int j = 0; j < i+1; ++j) {
-          delete[] dist_neighbors_[j];
-          delete[] label_neighbors_[j];
-        }
-        delete[] dist_neighbors_;
-        delete[] label_neighbors_;
       }
 
-      double **matrix = new double*[num_classes];
       for (int j = 0; j < num_classes; ++j) {
-        matrix[j] = new double[num_classes];
         int sum = 0;
         for (int k = 0; k < num_classes; ++k)
           sum += f_matrix[j][k];
@@ -885,8 +1097,6 @@ void OnlinePredict(const struct Problem *prob, const struct Parameter *param,
           matrix[j][k] = static_cast<double>(f_matrix[j][k]) / sum;
       }
 
-      double *quality = new double[num_classes];
-      double *avg_prob = new double[num_classes];
       for (int j = 0; j < num_classes; ++j) {
         quality[j] = matrix[0][j];
         avg_prob[j] = matrix[0][j];
@@ -932,18 +1142,8 @@ void OnlinePredict(const struct Problem *prob, const struct Parameter *param,
         std::cout << '\n';
       }
 
-      delete[] avg_prob;
-
       predict_labels[i] = labels[static_cast<std::size_t>(best)];
 
-      delete[] quality;
-      for (int j = 0; j < num_classes; ++j) {
-        delete[] f_matrix[j];
-        delete[] matrix[j];
-      }
-      delete[] f_matrix;
-      delete[] matrix;
-
       this_label = static_cast<int>(prob->y[indices[i]]);
       std::size_t j;
       for (j = 0; j < num_classes; ++j) {
@@ -955,14 +1155,12 @@ void OnlinePredict(const struct Problem *prob, const struct Parameter *param,
         ++num_classes;
       }
 
-      for (int j = 0; j < i; ++j) {
-        double dist = CalcDist(prob->x[indices[j]], prob->x[indices[i]]);
-        int index = CompareDist(dist_neighbors[j], dist, num_neighbors);
-        if (index < num_neighbors) {
-          InsertLabel(label_neighbors[j], alter_labels[i], num_neighbors, index);
-        }
+      for (std::size_t r = 0; r < rknn.size(); ++r) {
+        int k = rknn[r];
+        CompareDist(dist_neighbors[k], rknn_dists[r], num_neighbors);
+        InsertLabel(label_neighbors[k], alter_labels[i], num_neighbors, rknn_index[r]);
+        categories[k] = FindMostFrequent(label_neighbors[k], num_neighbors);
       }
-
     }
     if (param->probability == 1) {
       for (std::size_t j = 0; j < num_classes; ++j) {
@@ -976,8 +1174,17 @@ void OnlinePredict(const struct Problem *prob, const struct Parameter *param,
       delete[] label_neighbors[i];
     }
 
+    for (int j = 0; j < max_classes; ++j) {
+      delete[] f_matrix[j];
+      delete[] matrix[j];
+    }
+    delete[] f_matrix;
+    delete[] matrix;
+    delete[] quality;
+    delete[] avg_prob;
     delete[] dist_neighbors;
     delete[] label_neighbors;
+    delete[] label_neighbors_;
     delete[] categories;
     delete[] alter_labels;
     std::vector<int>(labels).swap(labels);
@@ -998,11 +1205,20 @@ void OnlinePredict(const struct Problem *prob, const struct Parameter *param,
       subprob.y[i] = prob->y[indices[i]];
     }
 
+    // each step is trained from the solvers of the previous step, which are kept in the workspaces with their
+    // kernel caches and grow by the new example (the other SVCs are warm started from the previous model)
+    Model *last_submodel = NULL;
+    SVMWorkspace *workspace = MakeSVMWorkspace(true);
+    MCSVMWorkspace *mcsvm_workspace = MakeMCSVMWorkspace();
+
     for (int i = 1; i < num_ex; ++i) {
       double *avg_prob = NULL;
       brier[i] = 0;
       subprob.num_ex = i;
-      Model *submodel = TrainVM(&subprob, param);
+      Model *submodel = TrainVM(&subprob, param, last_submodel, workspace, mcsvm_workspace);
+      if (last_submodel != NULL) {
+        FreeModel(last_submodel);
+      }
       predict_labels[i] = PredictVM(&subprob, submodel, subprob.x[i],
                                     lower_bounds[i], upper_bounds[i], &avg_prob);
       for (int j = 0; j < submodel->num_classes; ++j) {
@@ -1020,9 +1236,14 @@ void OnlinePredict(const struct Problem *prob, const struct Parameter *param,
       //   }
       //   std::cout << '\n';
       // }
-      FreeModel(submodel);
+      last_submodel = submodel;
       delete[] avg_prob;
     }
+    if (last_submodel != NULL) {
+      FreeModel(last_submodel);
+    }
+    FreeSVMWorkspace(workspace);
+    FreeMCSVMWorkspace(mcsvm_workspace);
     delete[] subprob.x;
     delete[] subprob.y;
   }
@@ -1069,6 +1290,16 @@ int SaveModel(const char *model_file_name, const struct Model *model) {
     model_file << '\n';
   }
 
+  if (model->category_counts) {
+    model_file << "category_counts\n";
+    for (int i = 0; i < GetNumCategoryRows(model->num_categories, model->num_classes); ++i) {
+      for (int j = 0; j < model->num_classes; ++j) {
+        model_file << model->category_counts[i][j] << ' ';
+      }
+    }
+    model_file << '\n';
+  }
+
   if (model->categories) {
     model_file << "categories\n";
     for (int i = 0; i < model->num_ex; ++i) {
@@ -1098,8 +1329,10 @@ Model *LoadModel(const char *model_file_name) {
 
   Parameter &param = model->param;
   param.load_model = 1;
+  param.num_threads = 1;
   model->labels = NULL;
   model->categories = NULL;
+  model->category_counts = NULL;
 
   char cmd[80];
   while (1) {
@@ -1172,6 +1405,16 @@ Model *LoadModel(const char *model_file_name) {
         model_file >> model->points[i];
       }
     } else
+    if (std::strcmp(cmd, "category_counts") == 0) {
+      int num_rows = GetNumCategoryRows(model->num_categories, model->num_classes);
+      model->category_counts = new int*[num_rows];
+      for (int i = 0; i < num_rows; ++i) {
+        model->category_counts[i] = new int[model->num_classes];
+        for (int j = 0; j < model->num_classes; ++j) {
+          model_file >> model->category_counts[i][j];
+        }
+      }
+    } else
     if (std::strcmp(cmd, "categories") == 0) {
       int num_ex = model->num_ex;
       model->categories = new int[num_ex];
@@ -1232,6 +1475,14 @@ void FreeModel(struct Model *model) {
     model->categories = NULL;
   }
 
+  if (model->category_counts != NULL) {
+    for (int i = 0; i < GetNumCategoryRows(model->num_categories, model->num_classes); ++i) {
+      delete[] model->category_counts[i];
+    }
+    delete[] model->category_counts;
+    model->category_counts = NULL;
+  }
+
   delete model;
   model = NULL;
 
@@ -19,6 +19,7 @@ struct Parameter {
   int taxonomy_type;
   int num_folds;
   int probability;
+  int num_threads;  // for reading data, cross validation folds and batch prediction, 0 for all cores
 };
 
 struct Model {
@@ -32,10 +33,15 @@ struct Model {
   int *labels;
   int *categories;
   double *points;
+  int **category_counts;  // category_counts[c][k]: #training examples in category c with label k
 };
 
 Model *TrainVM(const struct Problem *train, const struct Parameter *param);
+Model *TrainVM(const struct Problem *train, const struct Parameter *param, const struct Model *init_model);
+Model *TrainVM(const struct Problem *train, const struct Parameter *param, const struct Model *init_model, struct SVMWorkspace *workspace);
+Model *TrainVM(const struct Problem *train, const struct Parameter *param, const struct Model *init_model, struct SVMWorkspace *workspace, struct MCSVMWorkspace *mcsvm_workspace);
 double PredictVM(const struct Problem *train, const struct Model *model, const struct Node *x, double &lower, double &upper, double **avg_prob);
+void PredictVMBatch(const struct Problem *train, const struct Model *model, const struct Problem *test, int num_threads, double *predict_labels, double *lower_bounds, double *upper_bounds, double *avg_probs);
 void CrossValidation(const struct Problem *prob, const struct Parameter *param, double *predict_labels, double *lower_bounds, double *upper_bounds, double *brier, double *logloss);
 void OnlinePredict(const struct Problem *prob, const struct Parameter *param, double *predict_labels, int *indices, double *lower_bounds, double *upper_bounds, double *brier, double *logloss);
 